@@ -0,0 +1,21 @@
+#ifndef BOOK_H
+#define BOOK_H
+
+#include <string>
+#include <vector>
+#include "intern.h"
+
+struct Book {
+    int id = 0;
+    InternedString author;
+    std::string title;
+    int year = 0;
+    int pages = 0;
+    InternedString publisher;
+    long long isbn = 0;     // ISBN-13 as a number (see isbn.h), 0 = none
+    std::vector<unsigned char> photo;
+    std::string photoPath;
+    bool photoOmitted = false;  // Left out of a result list by the memory budget; getBook() has it
+};
+
+#endif // BOOK_H
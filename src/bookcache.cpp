@@ -0,0 +1,132 @@
+#include "bookcache.h"
+#include <algorithm>
+
+namespace {
+
+// List node, hash node and bucket overhead per entry, roughly
+const size_t kEntryOverhead = 64;
+
+// Ghost ids remembered at minimum, whatever the number of resident entries
+const size_t kMinGhosts = 256;
+
+size_t approxBytes(const Book& book) {
+    // Author and publisher are interned and shared, so only the handles count
+    return sizeof(Book) + kEntryOverhead + book.title.capacity() + book.photo.capacity() +
+           book.photoPath.capacity();
+}
+
+} // namespace
+
+BookCache::BookCache(size_t byteBudget) : budget(byteBudget) {}
+
+bool BookCache::get(int id, Book& book) {
+    auto it = index.find(id);
+    if (it == index.end()) {
+        misses++;
+        return false;
+    }
+    hits++;
+
+    // Hits in the admission FIFO only mark the entry; it is promoted when it reaches
+    // the end of the FIFO
+    EntryIt entry = it->second;
+    if (entry->frequent) frequent.splice(frequent.begin(), frequent, entry);
+    else entry->referenced = true;
+    book = entry->book;
+    return true;
+}
+
+void BookCache::put(const Book& book) {
+    size_t bytes = approxBytes(book);
+    bool promote = false;
+
+    auto it = index.find(book.id);
+    if (it != index.end()) {
+        promote = it->second->frequent;
+        remove(it->second);
+    }
+    auto ghost = ghostIndex.find(book.id);
+    if (ghost != ghostIndex.end()) {
+        promote = true;
+        ghosts.erase(ghost->second);
+        ghostIndex.erase(ghost);
+    }
+    if (bytes > budget) return;
+
+    std::list<Entry>& target = promote ? frequent : recent;
+    target.push_front(Entry{book, bytes, promote, false});
+    index[book.id] = target.begin();
+    (promote ? frequentBytes : recentBytes) += bytes;
+    evict();
+}
+
+void BookCache::erase(int id) {
+    auto it = index.find(id);
+    if (it != index.end()) remove(it->second);
+}
+
+void BookCache::clear() {
+    recent.clear();
+    frequent.clear();
+    index.clear();
+    ghosts.clear();
+    ghostIndex.clear();
+    recentBytes = 0;
+    frequentBytes = 0;
+}
+
+void BookCache::setBudget(size_t byteBudget) {
+    budget = byteBudget;
+    evict();
+}
+
+BookCacheStats BookCache::stats() const {
+    BookCacheStats s;
+    s.entries = index.size();
+    s.bytes = recentBytes + frequentBytes;
+    s.budget = budget;
+    s.hits = hits;
+    s.misses = misses;
+    return s;
+}
+
+void BookCache::remove(EntryIt it) {
+    index.erase(it->book.id);
+    if (it->frequent) {
+        frequentBytes -= it->bytes;
+        frequent.erase(it);
+    } else {
+        recentBytes -= it->bytes;
+        recent.erase(it);
+    }
+}
+
+void BookCache::evict() {
+    while (recentBytes + frequentBytes > budget) {
+        // The FIFO gets a quarter of the budget; beyond that its oldest entry leaves
+        // first, moving to the LRU if it was hit or becoming a ghost if not.
+        // Otherwise the LRU tail goes.
+        if (!recent.empty() && (recentBytes > budget / 4 || frequent.empty())) {
+            EntryIt oldest = std::prev(recent.end());
+            if (oldest->referenced) {
+                oldest->frequent = true;
+                recentBytes -= oldest->bytes;
+                frequentBytes += oldest->bytes;
+                frequent.splice(frequent.begin(), recent, oldest);
+                continue;
+            }
+            int id = oldest->book.id;
+            remove(oldest);
+
+            ghosts.push_front(id);
+            ghostIndex[id] = ghosts.begin();
+            size_t ghostLimit = std::max(kMinGhosts, index.size());
+            while (ghosts.size() > ghostLimit) {
+                ghostIndex.erase(ghosts.back());
+                ghosts.pop_back();
+            }
+        } else {
+            remove(std::prev(frequent.end()));
+        }
+    }
+}
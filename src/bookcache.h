@@ -0,0 +1,58 @@
+#ifndef BOOKCACHE_H
+#define BOOKCACHE_H
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include "book.h"
+
+struct BookCacheStats {
+    size_t entries = 0;
+    size_t bytes = 0;
+    size_t budget = 0;
+    long long hits = 0;
+    long long misses = 0;
+};
+
+// Id-keyed Book cache bounded by an approximate byte budget (photos included).
+// Uses 2Q replacement: new books wait in a small FIFO and are promoted to the main
+// LRU only if they were hit again while there or come back soon after leaving it,
+// so a pass over many books (export, dedup review) cannot flush the ones users keep
+// opening.
+class BookCache {
+public:
+    explicit BookCache(size_t byteBudget = 32 * 1024 * 1024);
+
+    bool get(int id, Book& book);
+    void put(const Book& book);
+    void erase(int id);
+    void clear();
+
+    void setBudget(size_t byteBudget);
+    BookCacheStats stats() const;
+
+private:
+    struct Entry {
+        Book book;
+        size_t bytes;
+        bool frequent;      // In the main LRU rather than the admission FIFO
+        bool referenced;    // Hit while in the FIFO
+    };
+    typedef std::list<Entry>::iterator EntryIt;
+
+    size_t budget;
+    size_t recentBytes = 0;
+    size_t frequentBytes = 0;
+    long long hits = 0;
+    long long misses = 0;
+    std::list<Entry> recent;            // A1in: FIFO, newest first
+    std::list<Entry> frequent;          // Am: LRU, most recent first
+    std::unordered_map<int, EntryIt> index;
+    std::list<int> ghosts;              // A1out: ids recently evicted from the FIFO
+    std::unordered_map<int, std::list<int>::iterator> ghostIndex;
+
+    void remove(EntryIt it);
+    void evict();
+};
+
+#endif // BOOKCACHE_H
@@ -0,0 +1,372 @@
+#include "booklist.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <iterator>
+#include <unordered_set>
+
+namespace {
+
+uint32_t orderedInt(int value) {
+    return static_cast<uint32_t>(value) ^ 0x80000000u;
+}
+
+// Beyond this share of the list changed, a reload (one table scan) is cheaper than
+// fetching the changed rows by id
+const size_t kReloadShare = 4;
+
+bool titleOrder(const BookSortKey& a, const BookSortKey& b) {
+    int c = a.title.compare(b.title);
+    return c != 0 ? c < 0 : a.id < b.id;
+}
+
+uint32_t rankOf(const std::vector<uint32_t>& ranks, int id) {
+    return id >= 0 && static_cast<size_t>(id) < ranks.size() ? ranks[id] : UINT32_MAX;
+}
+
+// Stable LSD radix sort on the upper 32 bits; the lower 32 bits ride along.
+// All four digit histograms come from one pass, and digits every item shares
+// are skipped.
+void radixSortHigh(std::vector<uint64_t>& items) {
+    const size_t n = items.size();
+    if (n < 2) return;
+
+    std::vector<size_t> counts(4 * 256, 0);
+    for (uint64_t v : items) {
+        for (int d = 0; d < 4; d++) counts[d * 256 + ((v >> (32 + 8 * d)) & 0xFF)]++;
+    }
+
+    std::vector<uint64_t> scratch(n);
+    for (int d = 0; d < 4; d++) {
+        size_t* bucket = &counts[d * 256];
+        const int shift = 32 + 8 * d;
+        if (bucket[(items[0] >> shift) & 0xFF] == n) continue;
+
+        size_t sum = 0;
+        for (int b = 0; b < 256; b++) {
+            size_t c = bucket[b];
+            bucket[b] = sum;
+            sum += c;
+        }
+        for (uint64_t v : items) scratch[bucket[(v >> shift) & 0xFF]++] = v;
+        items.swap(scratch);
+    }
+}
+
+} // namespace
+
+std::wstring utf8ToWide(const std::string& text) {
+    std::wstring out;
+    out.reserve(text.size());
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        unsigned int cp;
+        int extra;
+        if (c < 0x80) { cp = c; extra = 0; }
+        else if ((c & 0xE0) == 0xC0) { cp = c & 0x1F; extra = 1; }
+        else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; extra = 2; }
+        else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; extra = 3; }
+        else { cp = 0xFFFD; extra = 0; }
+        i++;
+
+        for (int k = 0; k < extra; k++, i++) {
+            if (i >= text.size() || (static_cast<unsigned char>(text[i]) & 0xC0) != 0x80) {
+                cp = 0xFFFD;
+                break;
+            }
+            cp = (cp << 6) | (static_cast<unsigned char>(text[i]) & 0x3F);
+        }
+        if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) cp = 0xFFFD;
+
+        if (sizeof(wchar_t) == 2 && cp > 0xFFFF) {
+            cp -= 0x10000;
+            out += static_cast<wchar_t>(0xD800 + (cp >> 10));
+            out += static_cast<wchar_t>(0xDC00 + (cp & 0x3FF));
+        } else {
+            out += static_cast<wchar_t>(cp);
+        }
+    }
+    return out;
+}
+
+BookListModel::BookListModel(Database& db, size_t cacheCapacity)
+    : db(db), capacity(std::max<size_t>(cacheCapacity, 1)) {}
+
+bool BookListModel::loadAll() {
+    filtered = false;
+    filter = BookFilter();
+    return reload();
+}
+
+bool BookListModel::loadFilter(const BookFilter& newFilter) {
+    filtered = true;
+    filter = newFilter;
+    return reload();
+}
+
+bool BookListModel::reload() {
+    generation++;
+    cache.clear();
+    cacheIndex.clear();
+    version = db.getChangeVersion();
+    bool success = db.getSortKeys(filter, keys) && db.getNameRanks(authorRanks, publisherRanks);
+    std::sort(keys.begin(), keys.end(), titleOrder);
+    sortBy(column, descending);
+    return success;
+}
+
+bool BookListModel::saveSnapshot(const std::string& path) const {
+    if (filtered) return false;
+
+    ListSnapshot snapshot;
+    snapshot.changeVersion = version;
+    snapshot.schemaVersion = db.getSchemaVersion();
+    snapshot.sortColumn = column;
+    snapshot.descending = descending;
+    snapshot.keys = keys;
+    snapshot.authorRanks = authorRanks;
+    snapshot.publisherRanks = publisherRanks;
+    std::string error;
+    return writeListSnapshot(path, snapshot, error);
+}
+
+bool BookListModel::loadSnapshot(const std::string& path) {
+    ListSnapshot snapshot;
+    std::string error;
+    if (!readListSnapshot(path, snapshot, error)) return false;
+    if (snapshot.schemaVersion != db.getSchemaVersion() || snapshot.changeVersion > db.getChangeVersion()) {
+        return false;
+    }
+
+    generation++;
+    cache.clear();
+    cacheIndex.clear();
+    filtered = false;
+    filter = BookFilter();
+    version = snapshot.changeVersion;
+    keys.swap(snapshot.keys);
+    authorRanks.swap(snapshot.authorRanks);
+    publisherRanks.swap(snapshot.publisherRanks);
+    sortBy(snapshot.sortColumn, snapshot.descending);
+    return true;
+}
+
+// Search results keep their membership: edited rows are refreshed and moved to their
+// new position, new books are only added to the unfiltered list. The batch is applied
+// in one pass over the result set, so the cost is O(rows + changes log changes)
+// however many changes the journal holds.
+bool BookListModel::applyChanges() {
+    Update update = beginUpdate();
+    computeUpdate(db, update);
+    if (!update.ok) {
+        reload();
+        return false;
+    }
+    installUpdate(update);
+    return !update.complete;
+}
+
+BookListModel::Update BookListModel::beginUpdate() const {
+    Update update;
+    update.generation = generation;
+    update.filtered = filtered;
+    update.filter = filter;
+    update.sinceVersion = version;
+    update.listSize = keys.size();
+    update.authorLimit = authorRanks.size();
+    update.publisherLimit = publisherRanks.size();
+    return update;
+}
+
+void BookListModel::computeUpdate(Database& db, Update& update) {
+    update.version = db.getChangeVersion();
+    std::vector<BookChange> changes;
+    bool journal = db.getChangesSince(update.sinceVersion, changes);
+
+    // A book may appear several times; its last entry decides
+    std::unordered_map<int, bool> deleted;
+    for (const BookChange& change : changes) deleted[change.bookId] = change.op == BookChange::Delete;
+
+    update.complete = !journal || deleted.size() > update.listSize / kReloadShare;
+    if (update.complete) {
+        update.ok = db.getSortKeys(update.filter, update.keys) &&
+                    db.getNameRanks(update.authorRanks, update.publisherRanks);
+        std::sort(update.keys.begin(), update.keys.end(), titleOrder);
+        return;
+    }
+
+    std::vector<int> refresh;
+    for (const auto& entry : deleted) {
+        update.changed.push_back(entry.first);
+        if (!entry.second) refresh.push_back(entry.first);
+    }
+    update.ok = db.getSortKeys(refresh, update.keys);
+    std::sort(update.keys.begin(), update.keys.end(), titleOrder);
+
+    for (const BookSortKey& key : update.keys) {
+        if (static_cast<size_t>(key.authorId) >= update.authorLimit ||
+            (key.publisherId != 0 && static_cast<size_t>(key.publisherId) >= update.publisherLimit)) {
+            update.ok = update.ok && db.getNameRanks(update.authorRanks, update.publisherRanks);
+            break;
+        }
+    }
+}
+
+bool BookListModel::installUpdate(Update& update) {
+    if (!update.ok || update.generation != generation) return false;
+    generation++;
+    version = update.version;
+
+    if (update.complete) {
+        cache.clear();
+        cacheIndex.clear();
+        keys.swap(update.keys);
+        authorRanks.swap(update.authorRanks);
+        publisherRanks.swap(update.publisherRanks);
+        sortBy(column, descending);
+        return true;
+    }
+    if (update.changed.empty()) return true;
+
+    std::unordered_set<int> changed(update.changed.begin(), update.changed.end());
+    for (int id : update.changed) evict(id);
+
+    std::unordered_set<int> present;
+    keys.erase(std::remove_if(keys.begin(), keys.end(), [&](const BookSortKey& key) {
+        if (!changed.count(key.id)) return false;
+        present.insert(key.id);
+        return true;
+    }), keys.end());
+
+    std::vector<BookSortKey>& fresh = update.keys;
+    if (filtered) {
+        fresh.erase(std::remove_if(fresh.begin(), fresh.end(), [&](const BookSortKey& key) {
+            return !present.count(key.id);
+        }), fresh.end());
+    }
+
+    bool ranksStale = false;
+    for (const BookSortKey& key : fresh) {
+        if (rankOf(authorRanks, key.authorId) == UINT32_MAX ||
+            (key.publisherId != 0 && rankOf(publisherRanks, key.publisherId) == UINT32_MAX)) {
+            ranksStale = true;
+        }
+    }
+
+    size_t middle = keys.size();
+    keys.insert(keys.end(), std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+    std::inplace_merge(keys.begin(), keys.begin() + middle, keys.end(), titleOrder);
+
+    if (!update.authorRanks.empty()) {
+        authorRanks.swap(update.authorRanks);
+        publisherRanks.swap(update.publisherRanks);
+    } else if (ranksStale) {
+        // An id reused after its name was pruned; rare enough to load here
+        db.getNameRanks(authorRanks, publisherRanks);
+    }
+    sortBy(column, descending);
+    return true;
+}
+
+uint32_t BookListModel::columnKey(const BookSortKey& key) const {
+    switch (column) {
+    case ColumnId: return orderedInt(key.id);
+    case ColumnAuthor: return rankOf(authorRanks, key.authorId);
+    case ColumnYear: return orderedInt(key.year);
+    case ColumnPages: return orderedInt(key.pages);
+    case ColumnPublisher:
+        // Books without a publisher sort first; unknown ids (UINT32_MAX) saturate and stay last
+        return key.publisherId == 0 ? 0 : std::min(rankOf(publisherRanks, key.publisherId), UINT32_MAX - 1) + 1;
+    default: return 0;
+    }
+}
+
+void BookListModel::sortBy(int newColumn, bool newDescending) {
+    column = newColumn >= 0 && newColumn < ColumnCount ? newColumn : ColumnTitle;
+    descending = newDescending;
+
+    const size_t n = keys.size();
+    order.resize(n);
+    if (column == ColumnTitle) {
+        // keys is already in title order
+        for (size_t i = 0; i < n; i++) order[i] = static_cast<uint32_t>(descending ? n - 1 - i : i);
+        return;
+    }
+
+    std::vector<uint64_t> packed(n);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t k = columnKey(keys[i]);
+        if (descending) k = ~k;
+        packed[i] = (static_cast<uint64_t>(k) << 32) | i;
+    }
+    radixSortHigh(packed);
+    for (size_t i = 0; i < n; i++) order[i] = static_cast<uint32_t>(packed[i]);
+}
+
+int BookListModel::rowOf(int id) const {
+    for (size_t row = 0; row < order.size(); row++) {
+        if (keys[order[row]].id == id) return static_cast<int>(row);
+    }
+    return -1;
+}
+
+const std::wstring& BookListModel::text(size_t row, int col) {
+    static const std::wstring empty;
+    if (row >= order.size() || col < 0 || col >= ColumnCount) return empty;
+
+    int id = keys[order[row]].id;
+    auto it = cacheIndex.find(id);
+    if (it != cacheIndex.end()) {
+        cache.splice(cache.begin(), cache, it->second);
+        return it->second->text[col];
+    }
+
+    Book book = db.getBook(id, false);
+    if (book.id == 0) return empty;
+    return store(book).text[col];
+}
+
+void BookListModel::prefetch(size_t first, size_t last) {
+    if (first >= order.size()) return;
+    last = std::min(last, order.size() - 1);
+    if (last < first) return;
+
+    // A window larger than the cache would only evict its own rows
+    if (last - first >= capacity) last = first + capacity - 1;
+
+    std::vector<int> missing;
+    for (size_t row = first; row <= last; row++) {
+        int id = keys[order[row]].id;
+        if (!cacheIndex.count(id)) missing.push_back(id);
+    }
+    if (missing.empty()) return;
+    for (const Book& book : db.getBooks(missing, false)) store(book);
+}
+
+const BookListModel::RenderedRow& BookListModel::store(const Book& book) {
+    evict(book.id);
+
+    cache.emplace_front();
+    RenderedRow& rendered = cache.front();
+    rendered.id = book.id;
+    rendered.text[ColumnId] = std::to_wstring(book.id);
+    rendered.text[ColumnAuthor] = utf8ToWide(book.author);
+    rendered.text[ColumnTitle] = utf8ToWide(book.title);
+    rendered.text[ColumnYear] = std::to_wstring(book.year);
+    rendered.text[ColumnPages] = std::to_wstring(book.pages);
+    rendered.text[ColumnPublisher] = utf8ToWide(book.publisher);
+    cacheIndex[book.id] = cache.begin();
+
+    while (cache.size() > capacity) {
+        cacheIndex.erase(cache.back().id);
+        cache.pop_back();
+    }
+    return rendered;
+}
+
+void BookListModel::evict(int id) {
+    auto it = cacheIndex.find(id);
+    if (it == cacheIndex.end()) return;
+    cache.erase(it->second);
+    cacheIndex.erase(it);
+}
@@ -0,0 +1,104 @@
+#ifndef BOOKLIST_H
+#define BOOKLIST_H
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "database.h"
+
+// Backing store for the owner-data (virtual) ListView. Only the sort keys of the
+// current result set are held; row text is fetched and converted to wide strings when
+// the view asks for it, and recently shown rows are kept in a small LRU cache.
+// Sorting by any column happens in memory without going back to the database.
+class BookListModel {
+public:
+    enum Column { ColumnId, ColumnAuthor, ColumnTitle, ColumnYear, ColumnPages, ColumnPublisher, ColumnCount };
+
+    explicit BookListModel(Database& db, size_t cacheCapacity = 512);
+
+    bool loadAll();
+    bool loadFilter(const BookFilter& filter);
+
+    // Unfiltered list saved on exit and mapped back in on the next start. A snapshot
+    // from another schema or a newer journal version is refused; an older one loads
+    // and applyChanges() then brings it up to date from the change journal.
+    bool saveSnapshot(const std::string& path) const;
+    bool loadSnapshot(const std::string& path);
+
+    // Applies the database change journal since the last load. Returns false when the
+    // journal could not be used, or changed so much of the list that a reload was
+    // cheaper, and the result set was reloaded instead.
+    bool applyChanges();
+
+    // applyChanges() in three steps so the database work can run on another thread:
+    // beginUpdate() and installUpdate() on the owning thread, computeUpdate() anywhere
+    // with its own connection (Database::openReader). installUpdate() drops an update
+    // the list has moved past (reloaded, or changed by applyChanges() meanwhile) and
+    // returns false for it; a failed one (ok false) is left to the caller to reload.
+    struct Update {
+        unsigned generation = 0;
+        bool filtered = false;
+        BookFilter filter;
+        long long sinceVersion = 0;
+        size_t listSize = 0;
+        size_t authorLimit = 0;             // Ids at or past these have no rank yet
+        size_t publisherLimit = 0;
+        long long version = 0;
+        bool complete = false;              // keys is the whole result set, not just changes
+        bool ok = false;
+        std::vector<int> changed;           // Ids to take out before keys is merged in
+        std::vector<BookSortKey> keys;      // Title order
+        std::vector<uint32_t> authorRanks;  // Empty unless a name is new to the list
+        std::vector<uint32_t> publisherRanks;
+    };
+    Update beginUpdate() const;
+    static void computeUpdate(Database& db, Update& update);
+    bool installUpdate(Update& update);
+
+    // Stable re-sort of the current result set; rows with equal keys stay in title order
+    void sortBy(int column, bool descending = false);
+    int sortColumn() const { return column; }
+    bool sortDescending() const { return descending; }
+
+    size_t size() const { return order.size(); }
+    bool showingAll() const { return !filtered; }
+    int idAt(size_t row) const { return row < order.size() ? keys[order[row]].id : -1; }
+    int rowOf(int id) const;
+
+    const std::wstring& text(size_t row, int col);
+    void prefetch(size_t first, size_t last);
+    size_t cachedRows() const { return cache.size(); }
+
+private:
+    struct RenderedRow {
+        int id;
+        std::wstring text[ColumnCount];
+    };
+
+    Database& db;
+    size_t capacity;
+    bool filtered = false;
+    BookFilter filter;
+    long long version = 0;
+    unsigned generation = 0;            // Bumped whenever keys is replaced or changed
+    std::vector<BookSortKey> keys;      // Result set in title order, ties by id
+    std::vector<uint32_t> order;        // View row -> index into keys
+    std::vector<uint32_t> authorRanks;
+    std::vector<uint32_t> publisherRanks;
+    int column = ColumnTitle;
+    bool descending = false;
+    std::list<RenderedRow> cache;
+    std::unordered_map<int, std::list<RenderedRow>::iterator> cacheIndex;
+
+    bool reload();
+    uint32_t columnKey(const BookSortKey& key) const;
+    const RenderedRow& store(const Book& book);
+    void evict(int id);
+};
+
+// UTF-8 to wchar_t (UTF-16 on Windows, UTF-32 elsewhere)
+std::wstring utf8ToWide(const std::string& text);
+
+#endif // BOOKLIST_H
@@ -1,5 +1,90 @@
 #include "database.h"
+#include "textfold.h"
+#include "phonetic.h"
+#include "isbn.h"
+#include "sqlitemem.h"
 #include <sstream>
+#include <climits>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <unordered_map>
+#include <chrono>
+#include <thread>
+
+namespace {
+
+// Column order matches rowToBook(); author and publisher text come from the dictionaries.
+const std::string kSelectBooks =
+    "SELECT b.id, a.name, b.title, b.year, b.pages, p.name, b.photo, b.isbn FROM books b "
+    "JOIN authors a ON a.id = b.author_id "
+    "LEFT JOIN publishers p ON p.id = b.publisher_id";
+
+// Same columns with the photo left out, for callers that only display text
+const std::string kSelectBooksNoPhoto =
+    "SELECT b.id, a.name, b.title, b.year, b.pages, p.name, NULL, b.isbn FROM books b "
+    "JOIN authors a ON a.id = b.author_id "
+    "LEFT JOIN publishers p ON p.id = b.publisher_id";
+
+// Substring match on the folded title. A range seek cannot serve a substring, so the
+// match runs as a subquery that only needs idx_title_key (key and rowid): SQLite scans
+// that narrow covering index instead of walking idx_title and reading every book row.
+const char* const kTitleKeyMatch = "b.id IN (SELECT id FROM books WHERE instr(title_key, ?) > 0)";
+
+// Fuzzy index key batches in index order; ?1 is the cursor, ?2 the batch size
+const char* const kAuthorKeyBatch =
+    "SELECT a.name_key, COUNT(*) FROM authors a JOIN books b ON b.author_id = a.id "
+    "WHERE a.name_key > ?1 GROUP BY a.name_key ORDER BY a.name_key LIMIT ?2;";
+const char* const kTitleKeyBatch =
+    "SELECT title_key, COUNT(*) FROM books WHERE title_key > ?1 "
+    "GROUP BY title_key ORDER BY title_key LIMIT ?2;";
+
+// Journal entries kept on open; older clients fall back to a full reload.
+const int kChangeJournalRetention = 10000;
+
+// Changed rows re-checked one by one against cached searches; beyond this (bulk
+// writes) the search cache is simply cleared.
+const size_t kMaxTrackedChanges = 256;
+
+// Larger results are not worth holding as id lists
+const size_t kMaxCachedResult = 100000;
+
+// Ids bound per IN list when loading rows by id (SQLite allows 32766 parameters)
+const size_t kIdChunkSize = 500;
+
+// Rows per transaction in upsertBooks
+const size_t kUpsertBatchSize = 1000;
+
+// How long a statement waits for another connection's lock (see openReader)
+const int kBusyTimeoutMs = 5000;
+
+// Shares of setMemoryBudget(); the rest covers the list model, statements and heap slack
+const double kSqliteBudgetShare = 0.40;
+const double kBookCacheBudgetShare = 0.20;
+const double kResultPhotoBudgetShare = 0.25;
+const double kSearchCacheBudgetShare = 0.05;
+
+// Used again when the budget is lifted
+const size_t kDefaultBookCacheBytes = 32 * 1024 * 1024;
+const int kDefaultCacheSizeKiB = 2000;
+
+// Identity of a catalogue record for upserts. Must match the SQL in assignNaturalKeys().
+std::string naturalKey(const Book& book) {
+    return foldText(book.author) + '\x1f' + foldText(book.title) + '\x1f' + std::to_string(book.year);
+}
+
+// SQL wrapper around foldText() so existing rows can be backfilled in one statement.
+void sqlFold(sqlite3_context* ctx, int /*argc*/, sqlite3_value** argv) {
+    const unsigned char* text = sqlite3_value_text(argv[0]);
+    if (!text) {
+        sqlite3_result_null(ctx);
+        return;
+    }
+    std::string key = foldText(reinterpret_cast<const char*>(text));
+    sqlite3_result_text(ctx, key.c_str(), static_cast<int>(key.size()), SQLITE_TRANSIENT);
+}
+
+} // namespace
 
 Database::Database() : db(nullptr) {}
 
@@ -12,276 +97,2259 @@ bool Database::open(const std::string& dbPath) {
         lastError = sqlite3_errmsg(db);
         return false;
     }
-    return createTables();
+    sqlite3_create_function_v2(db, "fold", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                               nullptr, sqlFold, nullptr, nullptr, nullptr);
+    sqlite3_busy_timeout(db, kBusyTimeoutMs);
+    
+    // auto_vacuum can only be chosen before the first table exists; older files are
+    // converted on request with enableIncrementalVacuum()
+    long long pageCount = 0;
+    if (queryInt("PRAGMA page_count;", pageCount) && pageCount == 0) execSql("PRAGMA auto_vacuum=INCREMENTAL;");
+    if (!migrate() || !pruneChangeJournal() || !trackNaturalKeys()) {
+        // A half-migrated or newer-format file is not used at all
+        std::string error = lastError;
+        close();
+        lastError = error;
+        return false;
+    }
+    
+    applyMemoryBudget();
+    
+    // 0x10002 also analyzes tables that were never analyzed, within analysis_limit
+    setAnalysisLimit(analysisLimit);
+    execSql("PRAGMA optimize=0x10002;");
+    
+    clearSearchCache();
+    sqlite3_update_hook(db, onRowChange, this);
+    return true;
+}
+
+bool Database::openReader(const std::string& dbPath) {
+    if (sqlite3_open_v2(dbPath.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        sqlite3_close(db);
+        db = nullptr;
+        return false;
+    }
+    readOnly = true;
+    sqlite3_create_function_v2(db, "fold", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                               nullptr, sqlFold, nullptr, nullptr, nullptr);
+    sqlite3_busy_timeout(db, kBusyTimeoutMs);
+    return true;
 }
 
 void Database::close() {
+    if (dataVersionStmt) {
+        sqlite3_finalize(dataVersionStmt);
+        dataVersionStmt = nullptr;
+    }
     if (db) {
+        // Refreshes statistics only for tables whose queries this session could have used them
+        if (!readOnly) execSql("PRAGMA optimize;");
         sqlite3_close(db);
         db = nullptr;
+        readOnly = false;
     }
+    resetFuzzyIndexes();
+    fuzzyWanted = true;
+    clearSearchCache();
+    bookCache.clear();
 }
 
-bool Database::createTables() {
-    const char* sql = R"(
-        CREATE TABLE IF NOT EXISTS books (
-            id INTEGER PRIMARY KEY AUTOINCREMENT,
-            author TEXT NOT NULL,
-            title TEXT NOT NULL,
-            year INTEGER,
-            pages INTEGER,
-            publisher TEXT,
-            photo BLOB
-        );
-        CREATE INDEX IF NOT EXISTS idx_author ON books(author);
-        CREATE INDEX IF NOT EXISTS idx_title ON books(title);
-        CREATE INDEX IF NOT EXISTS idx_year ON books(year);
-    )";
-    
+bool Database::execSql(const char* sql) {
     char* errMsg = nullptr;
     if (sqlite3_exec(db, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
-        lastError = errMsg;
+        lastError = errMsg ? errMsg : sqlite3_errmsg(db);
         sqlite3_free(errMsg);
         return false;
     }
     return true;
 }
 
-
-bool Database::addBook(const Book& book) {
-    const char* sql = "INSERT INTO books (author, title, year, pages, publisher, photo) VALUES (?, ?, ?, ?, ?, ?);";
+bool Database::hasColumn(const char* table, const char* column) {
+    std::string sql = std::string("PRAGMA table_info(") + table + ");";
     sqlite3_stmt* stmt;
+    bool found = false;
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        lastError = sqlite3_errmsg(db);
-        return false;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        while (!found && sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            found = name && std::string(name) == column;
+        }
+        sqlite3_finalize(stmt);
     }
+    return found;
+}
+
+bool Database::hasTable(const char* table) {
+    const char* sql = "SELECT 1 FROM sqlite_master WHERE type='table' AND name=?;";
+    sqlite3_stmt* stmt;
+    bool found = false;
     
-    sqlite3_bind_text(stmt, 1, book.author.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, book.title.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, 3, book.year);
-    sqlite3_bind_int(stmt, 4, book.pages);
-    sqlite3_bind_text(stmt, 5, book.publisher.c_str(), -1, SQLITE_TRANSIENT);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+        found = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    return found;
+}
+
+// Applied in order by migrate(); versions are PRAGMA user_version values and never reused
+const Database::Migration Database::kMigrations[] = {
+    {1, "baseline schema", &Database::createBaseSchema, nullptr, nullptr},
+    {2, "natural keys", nullptr,
+     "SELECT MIN(id), MAX(id) FROM books WHERE natural_key IS NULL;", &Database::assignNaturalKeys},
+    {3, "cover thumbnails", &Database::createThumbnailTable,
+     "SELECT MIN(id), MAX(id) FROM books WHERE photo IS NOT NULL;", &Database::buildThumbnails},
+};
+
+bool Database::migrate() {
+    const char* sql = R"(
+        CREATE TABLE IF NOT EXISTS schema_backfills (
+            version INTEGER PRIMARY KEY,
+            next_id INTEGER NOT NULL,
+            last_id INTEGER NOT NULL
+        );
+    )";
+    long long version = 0;
+    if (!queryInt("PRAGMA user_version;", version)) return false;
     
-    if (!book.photo.empty()) {
-        sqlite3_bind_blob(stmt, 6, book.photo.data(), static_cast<int>(book.photo.size()), SQLITE_TRANSIENT);
-    } else {
-        sqlite3_bind_null(stmt, 6);
+    const int latest = kMigrations[std::size(kMigrations) - 1].version;
+    if (version > latest) {
+        lastError = "The database was created by a newer version of Library Manager (schema " +
+                    std::to_string(version) + ")";
+        return false;
     }
+    if (!execSql(sql)) return false;
     
-    bool success = sqlite3_step(stmt) == SQLITE_DONE;
-    if (!success) lastError = sqlite3_errmsg(db);
-    sqlite3_finalize(stmt);
-    return success;
+    for (const Migration& migration : kMigrations) {
+        if (migration.version <= version) continue;
+        if (!execSql("BEGIN IMMEDIATE;")) return false;
+        
+        bool success = !migration.apply || (this->*migration.apply)();
+        if (success && migration.backfill) success = scheduleBackfill(migration);
+        if (success) {
+            std::string setVersion = "PRAGMA user_version=" + std::to_string(migration.version) + ";";
+            success = execSql(setVersion.c_str()) && execSql("COMMIT;");
+        }
+        if (!success) {
+            std::string error = lastError;
+            execSql("ROLLBACK;");
+            lastError = "Migration " + std::to_string(migration.version) + " (" + migration.name + ") failed: " + error;
+            return false;
+        }
+    }
+    return true;
 }
 
-bool Database::updateBook(const Book& book) {
-    const char* sql = "UPDATE books SET author=?, title=?, year=?, pages=?, publisher=?, photo=? WHERE id=?;";
+// Books written after this point already get the new shape, so the backfill covers
+// the id range that exists now
+bool Database::scheduleBackfill(const Migration& migration) {
     sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    if (sqlite3_prepare_v2(db, migration.backfillRange, -1, &stmt, nullptr) != SQLITE_OK) {
         lastError = sqlite3_errmsg(db);
         return false;
     }
+    bool success = sqlite3_step(stmt) == SQLITE_ROW;
+    long long firstId = success ? sqlite3_column_int64(stmt, 0) : 0;
+    long long lastId = success ? sqlite3_column_int64(stmt, 1) : 0;
+    bool empty = !success || sqlite3_column_type(stmt, 0) == SQLITE_NULL;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    if (!success || empty) return success;
     
-    sqlite3_bind_text(stmt, 1, book.author.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, book.title.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, 3, book.year);
-    sqlite3_bind_int(stmt, 4, book.pages);
-    sqlite3_bind_text(stmt, 5, book.publisher.c_str(), -1, SQLITE_TRANSIENT);
-    
-    if (!book.photo.empty()) {
-        sqlite3_bind_blob(stmt, 6, book.photo.data(), static_cast<int>(book.photo.size()), SQLITE_TRANSIENT);
-    } else {
-        sqlite3_bind_null(stmt, 6);
+    const char* sql = "INSERT OR REPLACE INTO schema_backfills (version, next_id, last_id) VALUES (?, ?, ?);";
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
     }
-    sqlite3_bind_int(stmt, 7, book.id);
-    
-    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_bind_int(stmt, 1, migration.version);
+    sqlite3_bind_int64(stmt, 2, firstId);
+    sqlite3_bind_int64(stmt, 3, lastId);
+    success = sqlite3_step(stmt) == SQLITE_DONE;
     if (!success) lastError = sqlite3_errmsg(db);
     sqlite3_finalize(stmt);
     return success;
 }
 
-bool Database::deleteBook(int id) {
-    const char* sql = "DELETE FROM books WHERE id=?;";
-    sqlite3_stmt* stmt;
+bool Database::runMigrationBatch(int batchSize, int& booksDone, bool& done) {
+    booksDone = 0;
+    done = false;
     
+    const char* sql = "SELECT version, next_id, last_id FROM schema_backfills ORDER BY version LIMIT 1;";
+    sqlite3_stmt* stmt;
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
         lastError = sqlite3_errmsg(db);
         return false;
     }
-    
-    sqlite3_bind_int(stmt, 1, id);
-    bool success = sqlite3_step(stmt) == SQLITE_DONE;
-    if (!success) lastError = sqlite3_errmsg(db);
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    int version = found ? sqlite3_column_int(stmt, 0) : 0;
+    long long nextId = found ? sqlite3_column_int64(stmt, 1) : 0;
+    long long lastId = found ? sqlite3_column_int64(stmt, 2) : 0;
     sqlite3_finalize(stmt);
-    return success;
-}
-
-Book Database::rowToBook(sqlite3_stmt* stmt) {
-    Book book;
-    book.id = sqlite3_column_int(stmt, 0);
-    book.author = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-    book.title = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-    book.year = sqlite3_column_int(stmt, 3);
-    book.pages = sqlite3_column_int(stmt, 4);
+    if (!found) {
+        done = true;
+        return true;
+    }
     
-    const char* pub = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-    if (pub) book.publisher = pub;
+    const Migration* migration = nullptr;
+    for (const Migration& candidate : kMigrations) {
+        if (candidate.version == version) migration = &candidate;
+    }
     
-    const void* blob = sqlite3_column_blob(stmt, 6);
-    int blobSize = sqlite3_column_bytes(stmt, 6);
-    if (blob && blobSize > 0) {
-        book.photo.assign(static_cast<const unsigned char*>(blob),
-                          static_cast<const unsigned char*>(blob) + blobSize);
+    // The rows and the saved position commit together, so an interrupted backfill
+    // resumes exactly where it stopped
+    long long toId = std::min(lastId, nextId + std::max(batchSize, 1) - 1);
+    if (!execSql("BEGIN IMMEDIATE;")) return false;
+    bool success = !migration || !migration->backfill || (this->*migration->backfill)(nextId, toId);
+    std::string progressSql = toId >= lastId || !migration
+        ? "DELETE FROM schema_backfills WHERE version=" + std::to_string(version) + ";"
+        : "UPDATE schema_backfills SET next_id=" + std::to_string(toId + 1) +
+          " WHERE version=" + std::to_string(version) + ";";
+    success = success && execSql(progressSql.c_str()) && execSql("COMMIT;");
+    if (!success) {
+        std::string error = lastError;
+        execSql("ROLLBACK;");
+        lastError = error;
+        return false;
     }
-    return book;
+    
+    booksDone = static_cast<int>(toId - nextId + 1);
+    long long pending = 0;
+    done = queryInt("SELECT COUNT(*) FROM schema_backfills;", pending) && pending == 0;
+    return true;
 }
 
-Book Database::getBook(int id) {
-    Book book;
-    const char* sql = "SELECT * FROM books WHERE id=?;";
-    sqlite3_stmt* stmt;
+MigrationStatus Database::getMigrationStatus() {
+    MigrationStatus status;
+    long long version = 0;
+    queryInt("PRAGMA user_version;", version);
+    status.userVersion = static_cast<int>(version);
+    status.latestVersion = kMigrations[std::size(kMigrations) - 1].version;
     
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT COUNT(*), IFNULL(SUM(last_id - next_id + 1), 0) FROM schema_backfills;";
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        sqlite3_bind_int(stmt, 1, id);
         if (sqlite3_step(stmt) == SQLITE_ROW) {
-            book = rowToBook(stmt);
+            status.pendingBackfills = sqlite3_column_int(stmt, 0);
+            status.backfillRemaining = sqlite3_column_int64(stmt, 1);
         }
         sqlite3_finalize(stmt);
     }
-    return book;
+    return status;
 }
 
-std::vector<Book> Database::getAllBooks() {
-    std::vector<Book> books;
-    const char* sql = "SELECT * FROM books ORDER BY title;";
-    sqlite3_stmt* stmt;
+// Migration 1: the schema as it stood before versioning. Every statement checks what
+// is already there, so it also brings older unversioned files up to date.
+bool Database::createBaseSchema() {
+    const char* sql = R"(
+        CREATE TABLE IF NOT EXISTS authors (
+            id INTEGER PRIMARY KEY,
+            name TEXT NOT NULL UNIQUE,
+            name_key TEXT NOT NULL
+        );
+        CREATE TABLE IF NOT EXISTS publishers (
+            id INTEGER PRIMARY KEY,
+            name TEXT NOT NULL UNIQUE,
+            name_key TEXT NOT NULL
+        );
+        CREATE INDEX IF NOT EXISTS idx_authors_key ON authors(name_key);
+        CREATE INDEX IF NOT EXISTS idx_publishers_key ON publishers(name_key);
+        CREATE TABLE IF NOT EXISTS books (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            author_id INTEGER NOT NULL REFERENCES authors(id),
+            title TEXT NOT NULL,
+            year INTEGER,
+            pages INTEGER,
+            publisher_id INTEGER REFERENCES publishers(id),
+            photo BLOB,
+            title_key TEXT,
+            natural_key TEXT,
+            isbn INTEGER
+        );
+    )";
+    if (!execSql(sql)) return false;
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            books.push_back(rowToBook(stmt));
-        }
-        sqlite3_finalize(stmt);
-    }
-    return books;
+    // Databases from before dictionary encoding still carry author/publisher text per row
+    if (hasColumn("books", "author") && !migrateToDictionaries()) return false;
+    
+    // Keys for existing rows are filled in by the backfill of migration 2
+    if (!hasColumn("books", "natural_key") && !execSql("ALTER TABLE books ADD COLUMN natural_key TEXT;")) return false;
+    if (!hasColumn("books", "isbn") && !execSql("ALTER TABLE books ADD COLUMN isbn INTEGER;")) return false;
+    
+    const char* indexSql = R"(
+        CREATE INDEX IF NOT EXISTS idx_title ON books(title);
+        CREATE INDEX IF NOT EXISTS idx_year ON books(year);
+        CREATE INDEX IF NOT EXISTS idx_title_key ON books(title_key);
+        CREATE INDEX IF NOT EXISTS idx_books_author ON books(author_id);
+        CREATE INDEX IF NOT EXISTS idx_books_publisher ON books(publisher_id);
+        CREATE UNIQUE INDEX IF NOT EXISTS idx_books_natural_key ON books(natural_key);
+        CREATE UNIQUE INDEX IF NOT EXISTS idx_books_isbn ON books(isbn);
+    )";
+    if (!execSql(indexSql)) return false;
+    
+    // One row per word of the author name, so "Henryk Sienkiewicz" is found by either name
+    bool phoneticExisted = hasTable("author_phonetic");
+    const char* phoneticSql = R"(
+        CREATE TABLE IF NOT EXISTS author_phonetic (
+            code TEXT NOT NULL,
+            author_id INTEGER NOT NULL,
+            PRIMARY KEY (code, author_id)
+        ) WITHOUT ROWID;
+    )";
+    if (!execSql(phoneticSql)) return false;
+    if (!phoneticExisted && !rebuildPhoneticIndex()) return false;
+    
+    // Change journal fed by triggers, so writes from other connections are seen too
+    const char* journalSql = R"(
+        CREATE TABLE IF NOT EXISTS book_changes (
+            version INTEGER PRIMARY KEY AUTOINCREMENT,
+            book_id INTEGER NOT NULL,
+            op INTEGER NOT NULL
+        );
+        CREATE TRIGGER IF NOT EXISTS trg_books_insert AFTER INSERT ON books BEGIN
+            INSERT INTO book_changes (book_id, op) VALUES (NEW.id, 1);
+        END;
+        CREATE TRIGGER IF NOT EXISTS trg_books_update AFTER UPDATE ON books BEGIN
+            INSERT INTO book_changes (book_id, op) VALUES (NEW.id, 2);
+        END;
+        CREATE TRIGGER IF NOT EXISTS trg_books_delete AFTER DELETE ON books BEGIN
+            INSERT INTO book_changes (book_id, op) VALUES (OLD.id, 3);
+        END;
+    )";
+    return execSql(journalSql);
 }
 
-std::vector<Book> Database::searchByAuthor(const std::string& author) {
-    std::vector<Book> books;
-    const char* sql = "SELECT * FROM books WHERE author LIKE ? ORDER BY title;";
-    sqlite3_stmt* stmt;
+bool Database::pruneChangeJournal() {
+    std::string pruneSql = "DELETE FROM book_changes WHERE version <= "
+                           "(SELECT MAX(version) FROM book_changes) - " +
+                           std::to_string(kChangeJournalRetention) + ";";
+    return execSql(pruneSql.c_str());
+}
+
+bool Database::migrateToDictionaries() {
+    if (!execSql("SAVEPOINT dictionaries;")) return false;
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        std::string pattern = "%" + author + "%";
-        sqlite3_bind_text(stmt, 1, pattern.c_str(), -1, SQLITE_TRANSIENT);
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            books.push_back(rowToBook(stmt));
+    bool success = hasColumn("books", "title_key") || execSql("ALTER TABLE books ADD COLUMN title_key TEXT;");
+    const char* sql = R"(
+        UPDATE books SET title_key = fold(title) WHERE title_key IS NULL;
+        INSERT OR IGNORE INTO authors (name, name_key)
+            SELECT DISTINCT author, fold(author) FROM books;
+        INSERT OR IGNORE INTO publishers (name, name_key)
+            SELECT DISTINCT publisher, fold(publisher) FROM books
+            WHERE publisher IS NOT NULL AND publisher <> '';
+        ALTER TABLE books ADD COLUMN author_id INTEGER REFERENCES authors(id);
+        ALTER TABLE books ADD COLUMN publisher_id INTEGER REFERENCES publishers(id);
+        UPDATE books SET author_id = (SELECT id FROM authors WHERE name = books.author),
+                         publisher_id = (SELECT id FROM publishers WHERE name = books.publisher);
+        DROP INDEX IF EXISTS idx_author;
+        DROP INDEX IF EXISTS idx_author_key;
+        DROP INDEX IF EXISTS idx_publisher_key;
+        ALTER TABLE books DROP COLUMN author;
+        ALTER TABLE books DROP COLUMN publisher;
+        DROP TABLE IF EXISTS author_phonetic;
+    )";
+    success = success && execSql(sql);
+    
+    // Per-row fold keys for author/publisher now live on the dictionaries
+    const char* staleColumns[] = {"author_key", "publisher_key"};
+    for (const char* column : staleColumns) {
+        if (success && hasColumn("books", column)) {
+            std::string drop = std::string("ALTER TABLE books DROP COLUMN ") + column + ";";
+            success = execSql(drop.c_str());
         }
-        sqlite3_finalize(stmt);
     }
-    return books;
+    
+    if (success) return execSql("RELEASE dictionaries;");
+    execSql("ROLLBACK TO dictionaries; RELEASE dictionaries;");
+    return false;
 }
 
-std::vector<Book> Database::searchByTitle(const std::string& title) {
-    std::vector<Book> books;
-    const char* sql = "SELECT * FROM books WHERE title LIKE ? ORDER BY title;";
-    sqlite3_stmt* stmt;
+bool Database::rebuildPhoneticIndex() {
+    if (!execSql("SAVEPOINT phonetic_index;")) return false;
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        std::string pattern = "%" + title + "%";
-        sqlite3_bind_text(stmt, 1, pattern.c_str(), -1, SQLITE_TRANSIENT);
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            books.push_back(rowToBook(stmt));
+    sqlite3_stmt* stmt;
+    bool success = sqlite3_prepare_v2(db, "SELECT id, name FROM authors;", -1, &stmt, nullptr) == SQLITE_OK;
+    if (success) {
+        while (success && sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            success = writePhoneticKeys(sqlite3_column_int(stmt, 0), name ? name : "");
         }
         sqlite3_finalize(stmt);
+    } else {
+        lastError = sqlite3_errmsg(db);
     }
-    return books;
+    
+    if (success) return execSql("RELEASE phonetic_index;");
+    execSql("ROLLBACK TO phonetic_index; RELEASE phonetic_index;");
+    return false;
 }
 
-std::vector<Book> Database::searchByYear(int year) {
-    std::vector<Book> books;
-    const char* sql = "SELECT * FROM books WHERE year=? ORDER BY title;";
+// Only one book per natural key holds it; further copies keep NULL (the unique index
+// allows any number of NULLs). This hands keys to keyless books whose key is free, for
+// the migration backfill; writes use assignFreedNaturalKeys(). Only ids in
+// [fromId, toId] are considered; walking the ranges in order gives the same result.
+bool Database::assignNaturalKeys(long long fromId, long long toId) {
+    const char* sql = R"(
+        UPDATE books SET natural_key = k.key
+        FROM (SELECT MIN(b.id) AS id,
+                     a.name_key || char(31) || b.title_key || char(31) || IFNULL(b.year, 0) AS key
+              FROM books b JOIN authors a ON a.id = b.author_id
+              WHERE b.natural_key IS NULL AND b.id BETWEEN ? AND ?
+              GROUP BY key) AS k
+        WHERE books.id = k.id
+          AND NOT EXISTS (SELECT 1 FROM books x WHERE x.natural_key = k.key);
+    )";
     sqlite3_stmt* stmt;
-    
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        sqlite3_bind_int(stmt, 1, year);
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            books.push_back(rowToBook(stmt));
-        }
-        sqlite3_finalize(stmt);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
     }
-    return books;
+    sqlite3_bind_int64(stmt, 1, fromId);
+    sqlite3_bind_int64(stmt, 2, toId);
+    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    return success;
 }
 
-std::vector<Book> Database::searchByYearRange(int startYear, int endYear) {
-    std::vector<Book> books;
-    const char* sql = "SELECT * FROM books WHERE year BETWEEN ? AND ? ORDER BY year, title;";
-    sqlite3_stmt* stmt;
+// Temp triggers note the titles whose natural key this connection may have freed: a
+// deleted key holder, a book whose key moved or was cleared, a keyless book whose
+// author, title or year changed. Writes by other connections are not seen; their
+// keyless copies wait for a later write here touching the same title.
+bool Database::trackNaturalKeys() {
+    const char* sql = R"(
+        CREATE TEMP TABLE IF NOT EXISTS natural_key_titles (title_key TEXT PRIMARY KEY) WITHOUT ROWID;
+        CREATE TEMP TRIGGER IF NOT EXISTS natural_key_delete AFTER DELETE ON main.books
+        WHEN OLD.natural_key IS NOT NULL AND OLD.title_key IS NOT NULL BEGIN
+            INSERT OR IGNORE INTO natural_key_titles VALUES (OLD.title_key);
+        END;
+        CREATE TEMP TRIGGER IF NOT EXISTS natural_key_update AFTER UPDATE OF natural_key, author_id, title_key, year ON main.books
+        WHEN (OLD.natural_key IS NOT NULL AND OLD.natural_key IS NOT NEW.natural_key) OR NEW.natural_key IS NULL BEGIN
+            INSERT OR IGNORE INTO natural_key_titles SELECT OLD.title_key WHERE OLD.title_key IS NOT NULL;
+            INSERT OR IGNORE INTO natural_key_titles SELECT NEW.title_key WHERE NEW.title_key IS NOT NULL;
+        END;
+    )";
+    return execSql(sql);
+}
+
+// assignNaturalKeys() limited to the titles noted since the last call. Every keyless
+// copy of such a title is considered, so the lowest id still wins as in a full pass.
+bool Database::assignFreedNaturalKeys() {
+    long long pending = 0;
+    if (!queryInt("SELECT EXISTS (SELECT 1 FROM temp.natural_key_titles);", pending)) return false;
+    if (!pending) return true;
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        sqlite3_bind_int(stmt, 1, startYear);
-        sqlite3_bind_int(stmt, 2, endYear);
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            books.push_back(rowToBook(stmt));
-        }
-        sqlite3_finalize(stmt);
-    }
-    return books;
+    const char* sql = R"(
+        UPDATE books SET natural_key = k.key
+        FROM (SELECT MIN(b.id) AS id,
+                     a.name_key || char(31) || b.title_key || char(31) || IFNULL(b.year, 0) AS key
+              FROM temp.natural_key_titles t
+              JOIN books b ON b.title_key = t.title_key
+              JOIN authors a ON a.id = b.author_id
+              WHERE b.natural_key IS NULL
+              GROUP BY key) AS k
+        WHERE books.id = k.id
+          AND NOT EXISTS (SELECT 1 FROM books x WHERE x.natural_key = k.key);
+        DELETE FROM temp.natural_key_titles;
+    )";
+    return execSql(sql);
 }
 
-std::vector<Book> Database::searchByPublisher(const std::string& publisher) {
-    std::vector<Book> books;
-    const char* sql = "SELECT * FROM books WHERE publisher LIKE ? ORDER BY title;";
+bool Database::writePhoneticKeys(int authorId, const std::string& name) {
+    const char* sql = "INSERT OR IGNORE INTO author_phonetic (code, author_id) VALUES (?, ?);";
     sqlite3_stmt* stmt;
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        std::string pattern = "%" + publisher + "%";
-        sqlite3_bind_text(stmt, 1, pattern.c_str(), -1, SQLITE_TRANSIENT);
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            books.push_back(rowToBook(stmt));
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    
+    bool success = true;
+    for (const std::string& code : phoneticCodes(name)) {
+        sqlite3_bind_text(stmt, 1, code.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 2, authorId);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            success = false;
+            lastError = sqlite3_errmsg(db);
+            break;
         }
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
     }
-    return books;
+    sqlite3_finalize(stmt);
+    return success;
 }
 
-std::vector<Book> Database::searchAdvanced(const std::string& author, const std::string& title,
-                                            int yearFrom, int yearTo, const std::string& publisher) {
-    std::vector<Book> books;
-    std::stringstream sql;
-    sql << "SELECT * FROM books WHERE 1=1";
-    
-    if (!author.empty()) sql << " AND author LIKE ?";
-    if (!title.empty()) sql << " AND title LIKE ?";
-    if (yearFrom > 0) sql << " AND year >= ?";
-    if (yearTo > 0) sql << " AND year <= ?";
-    if (!publisher.empty()) sql << " AND publisher LIKE ?";
-    sql << " ORDER BY title;";
-    
+// A row with NULL pixels is a pending preview; the triggers keep the table in step
+// with the photo column whatever connection writes it
+bool Database::createThumbnailTable() {
+    const char* sql = R"(
+        CREATE TABLE IF NOT EXISTS book_thumbnails (
+            book_id INTEGER PRIMARY KEY,
+            width INTEGER,
+            height INTEGER,
+            pixels BLOB
+        );
+        CREATE INDEX IF NOT EXISTS idx_thumbnails_pending ON book_thumbnails(book_id) WHERE pixels IS NULL;
+        CREATE TRIGGER IF NOT EXISTS trg_thumbnails_insert AFTER INSERT ON books
+        WHEN NEW.photo IS NOT NULL BEGIN
+            INSERT OR REPLACE INTO book_thumbnails (book_id) VALUES (NEW.id);
+        END;
+        CREATE TRIGGER IF NOT EXISTS trg_thumbnails_update AFTER UPDATE OF photo ON books
+        WHEN NEW.photo IS NOT OLD.photo BEGIN
+            DELETE FROM book_thumbnails WHERE book_id = NEW.id;
+            INSERT INTO book_thumbnails (book_id) SELECT NEW.id WHERE NEW.photo IS NOT NULL;
+        END;
+        CREATE TRIGGER IF NOT EXISTS trg_thumbnails_delete AFTER DELETE ON books BEGIN
+            DELETE FROM book_thumbnails WHERE book_id = OLD.id;
+        END;
+    )";
+    return execSql(sql);
+}
+
+// Backfill of migration 3: photos stored before thumbnails existed
+bool Database::buildThumbnails(long long fromId, long long toId) {
+    const char* sql = "INSERT OR IGNORE INTO book_thumbnails (book_id) "
+                      "SELECT id FROM books WHERE id BETWEEN ? AND ? AND photo IS NOT NULL;";
     sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.str().c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
-        int idx = 1;
-        if (!author.empty()) {
-            std::string p = "%" + author + "%";
-            sqlite3_bind_text(stmt, idx++, p.c_str(), -1, SQLITE_TRANSIENT);
-        }
-        if (!title.empty()) {
-            std::string p = "%" + title + "%";
-            sqlite3_bind_text(stmt, idx++, p.c_str(), -1, SQLITE_TRANSIENT);
-        }
-        if (yearFrom > 0) sqlite3_bind_int(stmt, idx++, yearFrom);
-        if (yearTo > 0) sqlite3_bind_int(stmt, idx++, yearTo);
-        if (!publisher.empty()) {
-            std::string p = "%" + publisher + "%";
-            sqlite3_bind_text(stmt, idx++, p.c_str(), -1, SQLITE_TRANSIENT);
-        }
-        
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    sqlite3_bind_int64(stmt, 1, fromId);
+    sqlite3_bind_int64(stmt, 2, toId);
+    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    return success && renderPendingThumbnails(fromId, toId);
+}
+
+bool Database::renderPendingThumbnails(long long fromId, long long toId) {
+    const char* sql = "SELECT book_id FROM book_thumbnails WHERE pixels IS NULL AND book_id BETWEEN ? AND ?;";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    sqlite3_bind_int64(stmt, 1, fromId);
+    sqlite3_bind_int64(stmt, 2, toId);
+    std::vector<int> ids;
+    while (sqlite3_step(stmt) == SQLITE_ROW) ids.push_back(sqlite3_column_int(stmt, 0));
+    sqlite3_finalize(stmt);
+    return renderThumbnails(ids);
+}
+
+// Of the given books, those whose preview the triggers queued
+bool Database::renderPendingThumbnails(const std::vector<int>& ids) {
+    std::vector<int> pending;
+    for (size_t start = 0; start < ids.size(); start += kIdChunkSize) {
+        size_t count = std::min(kIdChunkSize, ids.size() - start);
+        std::string sql = "SELECT book_id FROM book_thumbnails WHERE pixels IS NULL AND book_id IN (?";
+        for (size_t i = 1; i < count; i++) sql += ",?";
+        sql += ");";
+        
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            lastError = sqlite3_errmsg(db);
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) sqlite3_bind_int(stmt, static_cast<int>(i + 1), ids[start + i]);
+        while (sqlite3_step(stmt) == SQLITE_ROW) pending.push_back(sqlite3_column_int(stmt, 0));
+        sqlite3_finalize(stmt);
+    }
+    return renderThumbnails(pending);
+}
+
+// A photo no decoder understands gets an empty preview, so it is not tried again
+bool Database::renderThumbnails(const std::vector<int>& ids) {
+    if (ids.empty()) return true;
+    sqlite3_stmt* photoStmt;
+    sqlite3_stmt* storeStmt;
+    if (sqlite3_prepare_v2(db, "SELECT photo FROM books WHERE id=?;", -1, &photoStmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    const char* storeSql = "UPDATE book_thumbnails SET width=?, height=?, pixels=? WHERE book_id=?;";
+    if (sqlite3_prepare_v2(db, storeSql, -1, &storeStmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        sqlite3_finalize(photoStmt);
+        return false;
+    }
+    
+    bool success = true;
+    std::vector<unsigned char> photo;
+    std::vector<unsigned char> pixels;
+    for (size_t i = 0; success && i < ids.size(); i++) {
+        photo.clear();
+        sqlite3_bind_int(photoStmt, 1, ids[i]);
+        if (sqlite3_step(photoStmt) == SQLITE_ROW) {
+            const unsigned char* blob = static_cast<const unsigned char*>(sqlite3_column_blob(photoStmt, 0));
+            if (blob) photo.assign(blob, blob + sqlite3_column_bytes(photoStmt, 0));
+        }
+        sqlite3_reset(photoStmt);
+        
+        Image image;
+        bool decoded = decodeImage(photo, image);
+        if (decoded) {
+            makeThumbnail(image, kThumbnailWidth, kThumbnailHeight, pixels);
+            sqlite3_bind_int(storeStmt, 1, kThumbnailWidth);
+            sqlite3_bind_int(storeStmt, 2, kThumbnailHeight);
+            sqlite3_bind_blob(storeStmt, 3, pixels.data(), static_cast<int>(pixels.size()), SQLITE_STATIC);
+        } else {
+            sqlite3_bind_int(storeStmt, 1, 0);
+            sqlite3_bind_int(storeStmt, 2, 0);
+            sqlite3_bind_zeroblob(storeStmt, 3, 0);
+        }
+        sqlite3_bind_int(storeStmt, 4, ids[i]);
+        success = sqlite3_step(storeStmt) == SQLITE_DONE;
+        if (!success) lastError = sqlite3_errmsg(db);
+        sqlite3_reset(storeStmt);
+    }
+    sqlite3_finalize(photoStmt);
+    sqlite3_finalize(storeStmt);
+    return success;
+}
+
+bool Database::getThumbnails(const std::vector<int>& ids, std::vector<Thumbnail>& thumbnails) {
+    thumbnails.clear();
+    std::unordered_map<int, Thumbnail> found;
+    std::vector<int> pending;
+    
+    for (int pass = 0; pass < 2; pass++) {
+        const std::vector<int>& wanted = pass == 0 ? ids : pending;
+        for (size_t start = 0; start < wanted.size(); start += kIdChunkSize) {
+            size_t count = std::min(kIdChunkSize, wanted.size() - start);
+            std::string sql = "SELECT book_id, width, height, pixels FROM book_thumbnails WHERE book_id IN (?";
+            for (size_t i = 1; i < count; i++) sql += ",?";
+            sql += ");";
+            
+            sqlite3_stmt* stmt;
+            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+                lastError = sqlite3_errmsg(db);
+                return false;
+            }
+            for (size_t i = 0; i < count; i++) sqlite3_bind_int(stmt, static_cast<int>(i + 1), wanted[start + i]);
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                int bookId = sqlite3_column_int(stmt, 0);
+                if (sqlite3_column_type(stmt, 3) == SQLITE_NULL) {
+                    if (pass == 0) pending.push_back(bookId);
+                    continue;
+                }
+                const unsigned char* blob = static_cast<const unsigned char*>(sqlite3_column_blob(stmt, 3));
+                int bytes = sqlite3_column_bytes(stmt, 3);
+                if (!blob || bytes == 0) continue;
+                Thumbnail& thumbnail = found[bookId];
+                thumbnail.bookId = bookId;
+                thumbnail.width = sqlite3_column_int(stmt, 1);
+                thumbnail.height = sqlite3_column_int(stmt, 2);
+                thumbnail.pixels.assign(blob, blob + bytes);
+            }
+            sqlite3_finalize(stmt);
+        }
+        
+        if (pass == 1 || pending.empty()) break;
+        if (!execSql("SAVEPOINT render_thumbnails;")) return false;
+        if (!renderThumbnails(pending)) {
+            execSql("ROLLBACK TO render_thumbnails; RELEASE render_thumbnails;");
+            return false;
+        }
+        if (!execSql("RELEASE render_thumbnails;")) return false;
+    }
+    
+    for (int id : ids) {
+        auto it = found.find(id);
+        if (it != found.end()) thumbnails.push_back(it->second);
+    }
+    return true;
+}
+
+int Database::internName(const char* table, const std::string& name, bool& inserted) {
+    std::string insertSql = std::string("INSERT INTO ") + table +
+                            " (name, name_key) VALUES (?, ?) ON CONFLICT(name) DO NOTHING;";
+    sqlite3_stmt* stmt;
+    inserted = false;
+    
+    if (sqlite3_prepare_v2(db, insertSql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return 0;
+    }
+    std::string key = foldText(name);
+    sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, key.c_str(), -1, SQLITE_TRANSIENT);
+    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    if (!success) return 0;
+    
+    if (sqlite3_changes(db) == 1) {
+        inserted = true;
+        return static_cast<int>(sqlite3_last_insert_rowid(db));
+    }
+    
+    int id = 0;
+    std::string selectSql = std::string("SELECT id FROM ") + table + " WHERE name=?;";
+    if (sqlite3_prepare_v2(db, selectSql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    if (id == 0) lastError = sqlite3_errmsg(db);
+    return id;
+}
+
+int Database::internAuthor(const std::string& name) {
+    bool inserted;
+    int id = internName("authors", name, inserted);
+    if (id != 0 && inserted && !writePhoneticKeys(id, name)) return 0;
+    return id;
+}
+
+int Database::internPublisher(const std::string& name) {
+    bool inserted;
+    return internName("publishers", name, inserted);
+}
+
+bool Database::resolveNames(const Book& book, int& authorId, int& publisherId) {
+    authorId = internAuthor(book.author);
+    publisherId = book.publisher.empty() ? 0 : internPublisher(book.publisher);
+    return authorId != 0 && (book.publisher.empty() || publisherId != 0);
+}
+
+void Database::bindBookColumns(sqlite3_stmt* stmt, const Book& book, int authorId, int publisherId) {
+    sqlite3_bind_int(stmt, 1, authorId);
+    sqlite3_bind_text(stmt, 2, book.title.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 3, book.year);
+    sqlite3_bind_int(stmt, 4, book.pages);
+    
+    if (publisherId != 0) {
+        sqlite3_bind_int(stmt, 5, publisherId);
+    } else {
+        sqlite3_bind_null(stmt, 5);
+    }
+    
+    if (!book.photo.empty()) {
+        sqlite3_bind_blob(stmt, 6, book.photo.data(), static_cast<int>(book.photo.size()), SQLITE_TRANSIENT);
+    } else {
+        sqlite3_bind_null(stmt, 6);
+    }
+    
+    std::string titleKey = foldText(book.title);
+    sqlite3_bind_text(stmt, 7, titleKey.c_str(), -1, SQLITE_TRANSIENT);
+    
+    std::string key = naturalKey(book);
+    sqlite3_bind_text(stmt, 8, key.c_str(), -1, SQLITE_TRANSIENT);
+    
+    if (book.isbn != 0) {
+        sqlite3_bind_int64(stmt, 9, book.isbn);
+    } else {
+        sqlite3_bind_null(stmt, 9);
+    }
+}
+
+bool Database::checkIsbn(const Book& book) {
+    if (book.isbn == 0 || isValidIsbn(book.isbn)) return true;
+    lastError = "Invalid ISBN: " + std::to_string(book.isbn);
+    return false;
+}
+
+bool Database::addBook(const Book& book) {
+    // A further copy of a book already holding the natural key is stored without one
+    const char* sql = "INSERT INTO books (author_id, title, year, pages, publisher_id, photo, title_key, natural_key, isbn) "
+                      "VALUES (?, ?, ?, ?, ?, ?, ?, NULLIF(?8, (SELECT natural_key FROM books WHERE natural_key=?8)), ?9);";
+    sqlite3_stmt* stmt;
+    int authorId, publisherId;
+    
+    if (!checkIsbn(book)) return false;
+    if (!execSql("SAVEPOINT add_book;")) return false;
+    if (!resolveNames(book, authorId, publisherId)) {
+        execSql("ROLLBACK TO add_book; RELEASE add_book;");
+        return false;
+    }
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        execSql("ROLLBACK TO add_book; RELEASE add_book;");
+        return false;
+    }
+    
+    bindBookColumns(stmt, book, authorId, publisherId);
+    
+    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    
+    // The insert trigger queued the cover preview; it is rendered in the same savepoint
+    if (success && !book.photo.empty()) {
+        long long id = sqlite3_last_insert_rowid(db);
+        success = renderPendingThumbnails(id, id);
+    }
+    
+    if (!success) {
+        execSql("ROLLBACK TO add_book; RELEASE add_book;");
+        return false;
+    }
+    return execSql("RELEASE add_book;");
+}
+
+bool Database::updateBook(const Book& book) {
+    // A book from a budget-limited result list came without its photo; leaving the
+    // column out keeps the stored one instead of clearing it
+    std::string sql = "UPDATE books SET author_id=?, title=?, year=?, pages=?, publisher_id=?, ";
+    if (!book.photoOmitted) sql += "photo=?6, ";
+    sql += "title_key=?7, natural_key=NULLIF(?8, (SELECT natural_key FROM books WHERE natural_key=?8 AND id<>?10)), "
+           "isbn=?9 WHERE id=?10;";
+    sqlite3_stmt* stmt;
+    int authorId, publisherId;
+    
+    if (!checkIsbn(book)) return false;
+    if (!execSql("SAVEPOINT update_book;")) return false;
+    if (!resolveNames(book, authorId, publisherId)) {
+        execSql("ROLLBACK TO update_book; RELEASE update_book;");
+        return false;
+    }
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        execSql("ROLLBACK TO update_book; RELEASE update_book;");
+        return false;
+    }
+    
+    bindBookColumns(stmt, book, authorId, publisherId);
+    sqlite3_bind_int(stmt, 10, book.id);
+    
+    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    
+    // Queued by the update trigger only if the photo actually changed
+    if (success && !book.photo.empty()) success = renderPendingThumbnails(book.id, book.id);
+    
+    if (!success) {
+        execSql("ROLLBACK TO update_book; RELEASE update_book;");
+        return false;
+    }
+    return execSql("RELEASE update_book;");
+}
+
+bool Database::deleteBook(int id) {
+    const char* sql = "DELETE FROM books WHERE id=?;";
+    sqlite3_stmt* stmt;
+    
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    
+    sqlite3_bind_int(stmt, 1, id);
+    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    return success;
+}
+
+Book Database::rowToBook(sqlite3_stmt* stmt) {
+    Book book;
+    book.id = sqlite3_column_int(stmt, 0);
+    book.author = std::string_view(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                                   sqlite3_column_bytes(stmt, 1));
+    book.title = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+    book.year = sqlite3_column_int(stmt, 3);
+    book.pages = sqlite3_column_int(stmt, 4);
+    
+    const char* pub = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
+    if (pub) book.publisher = std::string_view(pub, sqlite3_column_bytes(stmt, 5));
+    
+    const void* blob = sqlite3_column_blob(stmt, 6);
+    int blobSize = sqlite3_column_bytes(stmt, 6);
+    if (blob && blobSize > 0) {
+        book.photo.assign(static_cast<const unsigned char*>(blob),
+                          static_cast<const unsigned char*>(blob) + blobSize);
+    }
+    book.isbn = sqlite3_column_int64(stmt, 7);
+    return book;
+}
+
+Book Database::getBook(int id, bool includePhoto) {
+    Book book;
+    
+    // Only complete rows are cached; text-only fetches come from list scrolling
+    if (includePhoto) {
+        syncBookCache();
+        if (bookCache.get(id, book)) return book;
+    }
+    
+    std::string sql = (includePhoto ? kSelectBooks : kSelectBooksNoPhoto) + " WHERE b.id=?;";
+    sqlite3_stmt* stmt;
+    
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, id);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            book = rowToBook(stmt);
+            if (includePhoto) bookCache.put(book);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return book;
+}
+
+std::vector<Book> Database::getBooks(const std::vector<int>& ids, bool includePhoto) {
+    std::vector<Book> books(ids.size());
+    std::unordered_map<int, size_t> position;
+    position.reserve(ids.size());
+    std::vector<int> missing;
+    size_t photoAllowance = resultPhotoLimit;
+    if (includePhoto) syncBookCache();
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (!position.emplace(ids[i], i).second) continue;
+        
+        // Cache hits are used but batch reads do not populate it
+        if (includePhoto && bookCache.get(ids[i], books[i])) {
+            fitPhoto(books[i], photoAllowance);
+            continue;
+        }
+        missing.push_back(ids[i]);
+    }
+    
+    // Chunked IN lists let SQLite seek the rows in rowid order, several times faster
+    // than one bound lookup per id
+    const std::string& select = includePhoto ? kSelectBooks : kSelectBooksNoPhoto;
+    for (size_t start = 0; start < missing.size(); start += kIdChunkSize) {
+        size_t count = std::min(kIdChunkSize, missing.size() - start);
+        std::string sql = select + " WHERE b.id IN (?";
+        for (size_t i = 1; i < count; i++) sql += ",?";
+        sql += ");";
+        
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            lastError = sqlite3_errmsg(db);
+            return std::vector<Book>();
+        }
+        for (size_t i = 0; i < count; i++) sqlite3_bind_int(stmt, static_cast<int>(i + 1), missing[start + i]);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            Book book = rowToBook(stmt);
+            fitPhoto(book, photoAllowance);
+            books[position[book.id]] = std::move(book);
+        }
+        sqlite3_finalize(stmt);
+    }
+    
+    // Repeated ids copy their first occurrence; ids that were not found leave empty slots
+    for (size_t i = 0; i < ids.size(); i++) {
+        size_t first = position[ids[i]];
+        if (first != i) books[i] = books[first];
+    }
+    books.erase(std::remove_if(books.begin(), books.end(), [](const Book& book) { return book.id == 0; }),
+                books.end());
+    return books;
+}
+
+Book Database::getBookByIsbn(long long isbn) {
+    std::vector<Book> books = getBooksByIsbn(std::vector<long long>(1, isbn));
+    return books.empty() ? Book() : books.front();
+}
+
+std::vector<Book> Database::getBooksByIsbn(const std::vector<long long>& isbns) {
+    std::vector<Book> books;
+    std::string sql = kSelectBooks + " WHERE b.isbn=?;";
+    sqlite3_stmt* stmt;
+    size_t photoAllowance = resultPhotoLimit;
+    
+    // One prepared statement, one idx_books_isbn probe per code; a scanner repeats
+    // codes, and those are looked up again so the result stays in scan order
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return books;
+    }
+    books.reserve(isbns.size());
+    for (long long isbn : isbns) {
+        if (isbn == 0) continue;
+        sqlite3_bind_int64(stmt, 1, isbn);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            books.push_back(rowToBook(stmt));
+            fitPhoto(books.back(), photoAllowance);
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    enforceMemoryBudget();
+    return books;
+}
+
+bool Database::forEachBook(const BookFilter& filter, bool includePhoto, const std::function<bool(const Book&)>& visit) {
+    // Names are resolved from the dictionaries loaded up front: joining authors and
+    // publishers costs two index seeks per row, most of the time of a full pass
+    std::vector<InternedString> authors, publishers;
+    if (!loadNames("SELECT id, name FROM authors;", authors) ||
+        !loadNames("SELECT id, name FROM publishers;", publishers)) {
+        return false;
+    }
+    
+    std::stringstream sql;
+    sql << "SELECT b.id, b.author_id, b.title, b.year, b.pages, b.publisher_id, "
+        << (includePhoto ? "b.photo" : "NULL") << ", b.isbn FROM books b WHERE 1=1";
+    appendFilter(sql, filter);
+    sql << " ORDER BY b.id;";
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.str().c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    bindFilter(stmt, filter, 1);
+    auto name = [](const std::vector<InternedString>& names, int id) {
+        return id > 0 && static_cast<size_t>(id) < names.size() ? names[id] : InternedString();
+    };
+    
+    // One Book is reused so the title and photo buffers keep their capacity
+    Book book;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        book.id = sqlite3_column_int(stmt, 0);
+        book.author = name(authors, sqlite3_column_int(stmt, 1));
+        const char* title = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        book.title.assign(title ? title : "", sqlite3_column_bytes(stmt, 2));
+        book.year = sqlite3_column_int(stmt, 3);
+        book.pages = sqlite3_column_int(stmt, 4);
+        book.publisher = name(publishers, sqlite3_column_int(stmt, 5));
+        const unsigned char* blob = static_cast<const unsigned char*>(sqlite3_column_blob(stmt, 6));
+        book.photo.assign(blob, blob + (blob ? sqlite3_column_bytes(stmt, 6) : 0));
+        book.isbn = sqlite3_column_int64(stmt, 7);
+        if (!visit(book)) {
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+    bool success = rc == SQLITE_DONE;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    return success;
+}
+
+// Dictionary names indexed by id (unused ids hold the empty string)
+bool Database::loadNames(const char* sql, std::vector<InternedString>& names) {
+    names.clear();
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int id = sqlite3_column_int(stmt, 0);
+        if (id <= 0) continue;
+        if (static_cast<size_t>(id) >= names.size()) names.resize(id + 1);
+        names[id] = std::string_view(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                                     sqlite3_column_bytes(stmt, 1));
+    }
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+bool Database::isEmptyFilter(const BookFilter& filter) const {
+    return filter.author.empty() && filter.title.empty() && filter.yearFrom <= 0 && filter.yearTo <= 0 &&
+           filter.publisher.empty();
+}
+
+bool Database::updateWhere(const BookFilter& filter, const BookUpdate& update, int& affected) {
+    affected = 0;
+    if (isEmptyFilter(filter)) {
+        lastError = "Bulk update needs a filter";
+        return false;
+    }
+    
+    std::vector<std::string> assignments;
+    if (!update.author.empty()) assignments.push_back("author_id=?");
+    if (!update.title.empty()) assignments.push_back("title=?, title_key=?");
+    if (update.year > 0) assignments.push_back("year=?");
+    if (update.pages > 0) assignments.push_back("pages=?");
+    if (!update.publisher.empty()) assignments.push_back("publisher_id=?");
+    if (assignments.empty()) {
+        lastError = "Bulk update has no fields to set";
+        return false;
+    }
+    
+    // Changed books give up their natural key and get a new one below if it is free
+    bool keyChanged = !update.author.empty() || !update.title.empty() || update.year > 0;
+    if (keyChanged) assignments.push_back("natural_key=NULL");
+    
+    std::stringstream sql;
+    sql << "UPDATE books SET ";
+    for (size_t i = 0; i < assignments.size(); i++) sql << (i ? ", " : "") << assignments[i];
+    sql << " WHERE id IN (SELECT b.id FROM books b WHERE 1=1";
+    appendFilter(sql, filter);
+    sql << ");";
+    
+    if (!execSql("SAVEPOINT update_where;")) return false;
+    
+    // New names go into the dictionaries inside the same transaction
+    int authorId = update.author.empty() ? 0 : internAuthor(update.author);
+    int publisherId = update.publisher.empty() ? 0 : internPublisher(update.publisher);
+    bool success = (update.author.empty() || authorId != 0) && (update.publisher.empty() || publisherId != 0);
+    
+    sqlite3_stmt* stmt = nullptr;
+    if (success && sqlite3_prepare_v2(db, sql.str().c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        success = false;
+    }
+    if (success) {
+        int idx = 1;
+        if (!update.author.empty()) sqlite3_bind_int(stmt, idx++, authorId);
+        if (!update.title.empty()) {
+            std::string titleKey = foldText(update.title);
+            sqlite3_bind_text(stmt, idx++, update.title.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt, idx++, titleKey.c_str(), -1, SQLITE_TRANSIENT);
+        }
+        if (update.year > 0) sqlite3_bind_int(stmt, idx++, update.year);
+        if (update.pages > 0) sqlite3_bind_int(stmt, idx++, update.pages);
+        if (!update.publisher.empty()) sqlite3_bind_int(stmt, idx++, publisherId);
+        bindFilter(stmt, filter, idx);
+        
+        success = sqlite3_step(stmt) == SQLITE_DONE;
+        if (success) affected = sqlite3_changes(db);
+        else lastError = sqlite3_errmsg(db);
+    }
+    sqlite3_finalize(stmt);
+    if (success && keyChanged) success = assignFreedNaturalKeys();
+    
+    if (!success) {
+        execSql("ROLLBACK TO update_where; RELEASE update_where;");
+        affected = 0;
+        return false;
+    }
+    return execSql("RELEASE update_where;");
+}
+
+bool Database::upsertBooks(const std::vector<Book>& books, UpsertResult& result) {
+    result = UpsertResult();
+    
+    // A matching ISBN identifies the book even if author, title or year were corrected;
+    // the record then takes the new natural key unless another book holds it. On a
+    // natural key match the folded author, title and year are already equal, and a
+    // missing ISBN keeps the stored one. The WHERE clauses skip the write, journal
+    // entry and hooks for unchanged rows.
+    const char* sql = R"(
+        INSERT INTO books (author_id, title, year, pages, publisher_id, photo, title_key, natural_key, isbn)
+        VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)
+        ON CONFLICT(isbn) DO UPDATE SET
+            author_id = excluded.author_id, title = excluded.title, year = excluded.year,
+            pages = excluded.pages, publisher_id = excluded.publisher_id,
+            photo = COALESCE(excluded.photo, photo), title_key = excluded.title_key,
+            natural_key = NULLIF(excluded.natural_key,
+                (SELECT x.natural_key FROM books x WHERE x.natural_key = excluded.natural_key AND x.id <> books.id))
+        WHERE author_id IS NOT excluded.author_id OR title IS NOT excluded.title
+           OR year IS NOT excluded.year OR pages IS NOT excluded.pages
+           OR publisher_id IS NOT excluded.publisher_id
+           OR (excluded.photo IS NOT NULL AND photo IS NOT excluded.photo)
+        ON CONFLICT(natural_key) DO UPDATE SET
+            author_id = excluded.author_id, title = excluded.title, pages = excluded.pages,
+            publisher_id = excluded.publisher_id, photo = COALESCE(excluded.photo, photo),
+            title_key = excluded.title_key, isbn = COALESCE(excluded.isbn, isbn)
+        WHERE author_id IS NOT excluded.author_id OR title IS NOT excluded.title
+           OR pages IS NOT excluded.pages OR publisher_id IS NOT excluded.publisher_id
+           OR (excluded.photo IS NOT NULL AND photo IS NOT excluded.photo)
+           OR (excluded.isbn IS NOT NULL AND isbn IS NOT excluded.isbn)
+        RETURNING id;
+    )";
+    
+    // Keys freed since the last write go to a remaining copy before matching
+    if (!assignFreedNaturalKeys()) return false;
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    
+    // Names are interned, so equal names share a pointer
+    std::unordered_map<const std::string*, int> authorIds;
+    std::unordered_map<const std::string*, int> publisherIds;
+    auto resolve = [&](const InternedString& name, std::unordered_map<const std::string*, int>& ids, bool author) {
+        auto it = ids.find(&name.str());
+        if (it != ids.end()) return it->second;
+        int id = author ? internAuthor(name) : internPublisher(name);
+        if (id != 0) ids[&name.str()] = id;
+        return id;
+    };
+    
+    bool success = true;
+    for (size_t start = 0; success && start < books.size(); start += kUpsertBatchSize) {
+        size_t end = std::min(books.size(), start + kUpsertBatchSize);
+        if (!execSql("SAVEPOINT upsert_books;")) {
+            success = false;
+            break;
+        }
+        
+        // Names interned by a failed batch are rolled back with it
+        std::unordered_map<const std::string*, int> savedAuthors = authorIds;
+        std::unordered_map<const std::string*, int> savedPublishers = publisherIds;
+        UpsertResult batch;
+        std::vector<int> photoIds;
+        for (size_t i = start; success && i < end; i++) {
+            const Book& book = books[i];
+            if (!checkIsbn(book)) {
+                success = false;
+                break;
+            }
+            int authorId = resolve(book.author, authorIds, true);
+            int publisherId = book.publisher.empty() ? 0 : resolve(book.publisher, publisherIds, false);
+            if (authorId == 0 || (!book.publisher.empty() && publisherId == 0)) {
+                success = false;
+                break;
+            }
+            
+            // Book ids are positive, so a non-zero rowid afterwards means the row was inserted.
+            // RETURNING yields the id of a written row, inserted or updated.
+            bindBookColumns(stmt, book, authorId, publisherId);
+            sqlite3_set_last_insert_rowid(db, 0);
+            int rc = sqlite3_step(stmt);
+            if (rc == SQLITE_ROW) {
+                if (!book.photo.empty()) photoIds.push_back(sqlite3_column_int(stmt, 0));
+                rc = sqlite3_step(stmt);
+            }
+            success = rc == SQLITE_DONE;
+            sqlite3_reset(stmt);
+            if (!success) {
+                lastError = sqlite3_errmsg(db);
+                break;
+            }
+            
+            if (sqlite3_changes(db) == 0) {
+                batch.unchanged++;
+                continue;
+            }
+            if (sqlite3_last_insert_rowid(db) != 0) batch.inserted++;
+            else batch.updated++;
+        }
+        
+        // Previews queued by this batch's photos; rows other connections wrote are
+        // rendered when first fetched
+        if (success) success = renderPendingThumbnails(photoIds);
+        
+        if (!success) {
+            execSql("ROLLBACK TO upsert_books; RELEASE upsert_books;");
+            authorIds.swap(savedAuthors);
+            publisherIds.swap(savedPublishers);
+            break;
+        }
+        success = execSql("RELEASE upsert_books;");
+        if (success) {
+            result.inserted += batch.inserted;
+            result.updated += batch.updated;
+            result.unchanged += batch.unchanged;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return success;
+}
+
+bool Database::deleteWhere(const BookFilter& filter, int& affected) {
+    affected = 0;
+    if (isEmptyFilter(filter)) {
+        lastError = "Bulk delete needs a filter";
+        return false;
+    }
+    
+    std::stringstream sql;
+    sql << "DELETE FROM books WHERE id IN (SELECT b.id FROM books b WHERE 1=1";
+    appendFilter(sql, filter);
+    sql << ");";
+    
+    // A single statement is already atomic; the journal rows its triggers write go with it
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.str().c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    bindFilter(stmt, filter, 1);
+    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    if (success) affected = sqlite3_changes(db);
+    else lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    return success;
+}
+
+bool Database::deleteBooks(const std::vector<int>& ids, int& affected) {
+    affected = 0;
+    if (ids.empty()) return true;
+    if (!execSql("SAVEPOINT delete_books;")) return false;
+    
+    bool success = true;
+    for (size_t start = 0; success && start < ids.size(); start += kIdChunkSize) {
+        size_t count = std::min(kIdChunkSize, ids.size() - start);
+        std::string sql = "DELETE FROM books WHERE id IN (?";
+        for (size_t i = 1; i < count; i++) sql += ",?";
+        sql += ");";
+        
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            lastError = sqlite3_errmsg(db);
+            success = false;
+            break;
+        }
+        for (size_t i = 0; i < count; i++) sqlite3_bind_int(stmt, static_cast<int>(i + 1), ids[start + i]);
+        success = sqlite3_step(stmt) == SQLITE_DONE;
+        if (success) affected += sqlite3_changes(db);
+        else lastError = sqlite3_errmsg(db);
+        sqlite3_finalize(stmt);
+    }
+    
+    if (!success) {
+        execSql("ROLLBACK TO delete_books; RELEASE delete_books;");
+        affected = 0;
+        return false;
+    }
+    return execSql("RELEASE delete_books;");
+}
+
+std::vector<Book> Database::getAllBooks() {
+    std::vector<Book> books;
+    std::string sql = kSelectBooks + " ORDER BY b.title;";
+    sqlite3_stmt* stmt;
+    size_t photoAllowance = resultPhotoLimit;
+    
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            books.push_back(rowToBook(stmt));
+            fitPhoto(books.back(), photoAllowance);
+        }
+        sqlite3_finalize(stmt);
+    }
+    enforceMemoryBudget();
+    return books;
+}
+
+std::vector<Book> Database::searchByAuthor(const std::string& author) {
+    return cachedSearch("b.author_id IN (SELECT id FROM authors WHERE instr(name_key, ?) > 0)",
+                        {{true, foldText(author), 0}}, "b.title");
+}
+
+std::vector<Book> Database::searchByTitle(const std::string& title) {
+    return cachedSearch(kTitleKeyMatch, {{true, foldText(title), 0}}, "b.title");
+}
+
+std::vector<Book> Database::searchByYear(int year) {
+    return cachedSearch("b.year=?", {{false, "", year}}, "b.title");
+}
+
+std::vector<Book> Database::searchByYearRange(int startYear, int endYear) {
+    return cachedSearch("b.year BETWEEN ? AND ?", {{false, "", startYear}, {false, "", endYear}}, "b.year, b.title");
+}
+
+std::vector<Book> Database::searchByPublisher(const std::string& publisher) {
+    return cachedSearch("b.publisher_id IN (SELECT id FROM publishers WHERE instr(name_key, ?) > 0)",
+                        {{true, foldText(publisher), 0}}, "b.title");
+}
+
+void Database::appendFilter(std::stringstream& sql, const BookFilter& filter) {
+    if (!filter.author.empty()) sql << " AND b.author_id IN (SELECT id FROM authors WHERE instr(name_key, ?) > 0)";
+    if (!filter.title.empty()) sql << " AND " << kTitleKeyMatch;
+    if (filter.yearFrom > 0) sql << " AND b.year >= ?";
+    if (filter.yearTo > 0) sql << " AND b.year <= ?";
+    if (!filter.publisher.empty()) sql << " AND b.publisher_id IN (SELECT id FROM publishers WHERE instr(name_key, ?) > 0)";
+}
+
+std::vector<Database::SqlArg> Database::filterArgs(const BookFilter& filter) {
+    // Same order as the placeholders written by appendFilter
+    std::vector<SqlArg> args;
+    if (!filter.author.empty()) args.push_back({true, foldText(filter.author), 0});
+    if (!filter.title.empty()) args.push_back({true, foldText(filter.title), 0});
+    if (filter.yearFrom > 0) args.push_back({false, "", filter.yearFrom});
+    if (filter.yearTo > 0) args.push_back({false, "", filter.yearTo});
+    if (!filter.publisher.empty()) args.push_back({true, foldText(filter.publisher), 0});
+    return args;
+}
+
+int Database::bindArgs(sqlite3_stmt* stmt, const std::vector<SqlArg>& args, int idx) {
+    for (const SqlArg& arg : args) {
+        if (arg.isText) sqlite3_bind_text(stmt, idx++, arg.text.c_str(), -1, SQLITE_TRANSIENT);
+        else sqlite3_bind_int(stmt, idx++, arg.number);
+    }
+    return idx;
+}
+
+int Database::bindFilter(sqlite3_stmt* stmt, const BookFilter& filter, int idx) {
+    return bindArgs(stmt, filterArgs(filter), idx);
+}
+
+std::vector<Book> Database::searchAdvanced(const std::string& author, const std::string& title,
+                                            int yearFrom, int yearTo, const std::string& publisher) {
+    BookFilter filter;
+    filter.author = author;
+    filter.title = title;
+    filter.yearFrom = yearFrom;
+    filter.yearTo = yearTo;
+    filter.publisher = publisher;
+    return searchAdvanced(filter);
+}
+
+std::vector<Book> Database::searchAdvanced(const BookFilter& filter) {
+    std::stringstream where;
+    where << "1=1";
+    appendFilter(where, filter);
+    return cachedSearch(where.str(), filterArgs(filter), "b.title");
+}
+
+BookSortKey Database::rowToSortKey(sqlite3_stmt* stmt) {
+    BookSortKey key;
+    key.id = sqlite3_column_int(stmt, 0);
+    key.authorId = sqlite3_column_int(stmt, 1);
+    key.publisherId = sqlite3_column_int(stmt, 2);
+    key.year = sqlite3_column_int(stmt, 3);
+    key.pages = sqlite3_column_int(stmt, 4);
+    key.title.assign(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5)), sqlite3_column_bytes(stmt, 5));
+    return key;
+}
+
+bool Database::getSortKeys(const BookFilter& filter, std::vector<BookSortKey>& keys) {
+    keys.clear();
+    
+    // Only b.* columns are read; names are resolved later through getNameRanks.
+    // No ORDER BY: walking idx_title visits table rows in random order, which is
+    // several times slower than a table scan followed by an in-memory sort.
+    std::stringstream sql;
+    sql << "SELECT b.id, b.author_id, b.publisher_id, b.year, b.pages, b.title FROM books b WHERE 1=1";
+    appendFilter(sql, filter);
+    sql << ";";
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.str().c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    bindFilter(stmt, filter, 1);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        keys.push_back(rowToSortKey(stmt));
+    }
+    bool success = rc == SQLITE_DONE;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    return success;
+}
+
+// Ids that no longer exist are skipped; keys come back in rowid order
+bool Database::getSortKeys(const std::vector<int>& ids, std::vector<BookSortKey>& keys) {
+    keys.clear();
+    for (size_t start = 0; start < ids.size(); start += kIdChunkSize) {
+        size_t count = std::min(kIdChunkSize, ids.size() - start);
+        std::string sql = "SELECT id, author_id, publisher_id, year, pages, title FROM books WHERE id IN (?";
+        for (size_t i = 1; i < count; i++) sql += ",?";
+        sql += ");";
+        
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            lastError = sqlite3_errmsg(db);
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) sqlite3_bind_int(stmt, static_cast<int>(i + 1), ids[start + i]);
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            keys.push_back(rowToSortKey(stmt));
+        }
+        bool success = rc == SQLITE_DONE;
+        if (!success) lastError = sqlite3_errmsg(db);
+        sqlite3_finalize(stmt);
+        if (!success) return false;
+    }
+    return true;
+}
+
+bool Database::loadNameRanks(const char* sql, std::vector<uint32_t>& ranks) {
+    ranks.clear();
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    uint32_t rank = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int id = sqlite3_column_int(stmt, 0);
+        if (id < 0) continue;
+        if (static_cast<size_t>(id) >= ranks.size()) ranks.resize(id + 1, UINT32_MAX);
+        ranks[id] = rank++;
+    }
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+bool Database::getNameRanks(std::vector<uint32_t>& authorRanks, std::vector<uint32_t>& publisherRanks) {
+    // The UNIQUE constraints on name provide the ordering index
+    return loadNameRanks("SELECT id FROM authors ORDER BY name;", authorRanks) &&
+           loadNameRanks("SELECT id FROM publishers ORDER BY name;", publisherRanks);
+}
+
+int Database::countRows(const std::string& sql, const BookFilter* filter) {
+    int count = -1;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return -1;
+    }
+    if (filter) bindFilter(stmt, *filter, 1);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        count = sqlite3_column_int(stmt, 0);
+    } else {
+        lastError = sqlite3_errmsg(db);
+    }
+    sqlite3_finalize(stmt);
+    return count;
+}
+
+int Database::countAll() {
+    // COUNT(*) without a WHERE clause walks the smallest index, not the table
+    return countRows("SELECT COUNT(*) FROM books;", nullptr);
+}
+
+int Database::countAdvanced(const BookFilter& filter) {
+    // Covering only for a single year, author or publisher filter (idx_year,
+    // idx_books_author/publisher). Title matches come back as ids from idx_title_key
+    // and, like any second condition, are checked against the book row.
+    std::stringstream sql;
+    sql << "SELECT COUNT(*) FROM books b WHERE 1=1";
+    appendFilter(sql, filter);
+    sql << ";";
+    return countRows(sql.str(), &filter);
+}
+
+BookFacets Database::getFacets(const BookFilter& filter, size_t maxValues) {
+    BookFacets facets;
+    std::stringstream sql;
+    sql << "SELECT b.author_id, b.publisher_id, b.year FROM books b WHERE 1=1";
+    appendFilter(sql, filter);
+    sql << ";";
+    
+    // One pass over the matching rows; only ids and years are read, never titles or photos
+    std::unordered_map<int, int> authorCounts, publisherCounts, decadeCounts;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.str().c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return facets;
+    }
+    bindFilter(stmt, filter, 1);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        facets.total++;
+        authorCounts[sqlite3_column_int(stmt, 0)]++;
+        if (sqlite3_column_type(stmt, 1) != SQLITE_NULL) publisherCounts[sqlite3_column_int(stmt, 1)]++;
+        int year = sqlite3_column_int(stmt, 2);
+        if (year > 0) decadeCounts[year / 10 * 10]++;
+    }
+    sqlite3_finalize(stmt);
+    
+    auto topValues = [maxValues](const std::unordered_map<int, int>& counts) {
+        std::vector<std::pair<int, int>> sorted(counts.begin(), counts.end());
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        if (maxValues > 0 && sorted.size() > maxValues) sorted.resize(maxValues);
+        return sorted;
+    };
+    
+    const char* nameSql[] = {"SELECT name FROM authors WHERE id=?;", "SELECT name FROM publishers WHERE id=?;"};
+    const std::unordered_map<int, int>* nameCounts[] = {&authorCounts, &publisherCounts};
+    std::vector<FacetCount>* nameFacets[] = {&facets.authors, &facets.publishers};
+    for (int i = 0; i < 2; i++) {
+        if (sqlite3_prepare_v2(db, nameSql[i], -1, &stmt, nullptr) != SQLITE_OK) continue;
+        for (const auto& entry : topValues(*nameCounts[i])) {
+            sqlite3_bind_int(stmt, 1, entry.first);
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                nameFacets[i]->push_back({reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)), entry.second});
+            }
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+    }
+    
+    for (const auto& entry : topValues(decadeCounts)) {
+        facets.decades.push_back({std::to_string(entry.first) + "s", entry.second});
+    }
+    return facets;
+}
+
+int Database::queryDataVersion() {
+    // Checked before every cached lookup, so the statement stays prepared
+    if (!dataVersionStmt &&
+        sqlite3_prepare_v2(db, "PRAGMA data_version;", -1, &dataVersionStmt, nullptr) != SQLITE_OK) {
+        dataVersionStmt = nullptr;
+        return 0;
+    }
+    int version = 0;
+    if (sqlite3_step(dataVersionStmt) == SQLITE_ROW) version = sqlite3_column_int(dataVersionStmt, 0);
+    sqlite3_reset(dataVersionStmt);
+    return version;
+}
+
+// Empty indexes need no change tracking; syncFuzzyIndexes() starts it again before loading
+void Database::resetFuzzyIndexes() {
+    authorFuzzyIndex = FuzzyIndex();
+    titleFuzzyIndex = FuzzyIndex();
+    if (fuzzyTracking && db) {
+        execSql("DROP TRIGGER IF EXISTS temp.fuzzy_books_insert; DROP TRIGGER IF EXISTS temp.fuzzy_books_delete; "
+                "DROP TRIGGER IF EXISTS temp.fuzzy_books_update; DROP TABLE IF EXISTS temp.fuzzy_changes;");
+    }
+    fuzzyTracking = false;
+}
+
+// Brings the loaded part of both indexes up to date with committed data. Inside an open
+// transaction nothing is applied: the pending rows could still be rolled back.
+bool Database::syncFuzzyIndexes() {
+    if (!sqlite3_get_autocommit(db)) return true;
+    int version = queryDataVersion();
+    if (version != fuzzyDataVersion) {
+        resetFuzzyIndexes();
+        fuzzyDataVersion = version;
+    }
+    
+    if (!fuzzyTracking) {
+        // Temp triggers fire for this connection's writes only, whichever method makes them
+        const char* sql = R"(
+            CREATE TEMP TABLE IF NOT EXISTS fuzzy_changes (delta INTEGER NOT NULL, author_key TEXT, title_key TEXT);
+            CREATE TEMP TRIGGER IF NOT EXISTS fuzzy_books_insert AFTER INSERT ON main.books BEGIN
+                INSERT INTO fuzzy_changes VALUES (1, (SELECT name_key FROM main.authors WHERE id = NEW.author_id), NEW.title_key);
+            END;
+            CREATE TEMP TRIGGER IF NOT EXISTS fuzzy_books_delete AFTER DELETE ON main.books BEGIN
+                INSERT INTO fuzzy_changes VALUES (-1, (SELECT name_key FROM main.authors WHERE id = OLD.author_id), OLD.title_key);
+            END;
+            CREATE TEMP TRIGGER IF NOT EXISTS fuzzy_books_update AFTER UPDATE OF author_id, title_key ON main.books
+            WHEN NEW.author_id IS NOT OLD.author_id OR NEW.title_key IS NOT OLD.title_key BEGIN
+                INSERT INTO fuzzy_changes VALUES (-1, (SELECT name_key FROM main.authors WHERE id = OLD.author_id), OLD.title_key);
+                INSERT INTO fuzzy_changes VALUES (1, (SELECT name_key FROM main.authors WHERE id = NEW.author_id), NEW.title_key);
+            END;
+        )";
+        if (!execSql(sql)) return false;
+        fuzzyTracking = true;
+        return true;
+    }
+    
+    // Keys past a cursor are skipped: the next batch reads them from the table anyway
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "SELECT delta, author_key, title_key FROM temp.fuzzy_changes;", -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    auto apply = [](FuzzyIndex& index, const unsigned char* text, int delta) {
+        if (!text) return;
+        std::string key = reinterpret_cast<const char*>(text);
+        if (!index.complete && key > index.cursor) return;
+        if (delta > 0) index.keys.add(key);
+        else index.keys.remove(key);
+    };
+    bool changed = false;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int delta = sqlite3_column_int(stmt, 0);
+        apply(authorFuzzyIndex, sqlite3_column_text(stmt, 1), delta);
+        apply(titleFuzzyIndex, sqlite3_column_text(stmt, 2), delta);
+        changed = true;
+    }
+    sqlite3_finalize(stmt);
+    return !changed || execSql("DELETE FROM temp.fuzzy_changes;");
+}
+
+bool Database::extendFuzzyIndex(FuzzyIndex& index, const char* batchSql, int batchKeys, int& keysLoaded) {
+    if (index.complete) return true;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, batchSql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, index.cursor.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 2, batchKeys);
+    // Keys past the cursor are new to the set, and GROUP BY makes them distinct
+    std::vector<std::pair<std::string, int>> keys;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        keys.push_back({reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)), sqlite3_column_int(stmt, 1)});
+    }
+    if (rc != SQLITE_DONE) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) return false;
+    
+    index.keys.addNew(keys);
+    if (!keys.empty()) index.cursor = keys.back().first;
+    keysLoaded += static_cast<int>(keys.size());
+    if (static_cast<int>(keys.size()) < batchKeys) index.complete = true;
+    return true;
+}
+
+bool Database::buildFuzzyIndexes(int batchKeys, int& keysLoaded, bool& done) {
+    keysLoaded = 0;
+    done = !fuzzyWanted || (authorFuzzyIndex.complete && titleFuzzyIndex.complete);
+    // Loading inside a transaction could pick up rows that are later rolled back
+    if (done || !sqlite3_get_autocommit(db)) return true;
+    if (!syncFuzzyIndexes()) return false;
+    if (!extendFuzzyIndex(authorFuzzyIndex, kAuthorKeyBatch, batchKeys, keysLoaded)) return false;
+    if (!extendFuzzyIndex(titleFuzzyIndex, kTitleKeyBatch, batchKeys, keysLoaded)) return false;
+    done = authorFuzzyIndex.complete && titleFuzzyIndex.complete;
+    return true;
+}
+
+std::vector<Book> Database::searchFuzzy(FuzzyIndex& index, const char* batchSql, const char* keyCondition,
+                                        const std::string& query, int maxDistance) {
+    std::vector<Book> books;
+    fuzzyWanted = true;
+    int keysLoaded = 0;
+    if (!syncFuzzyIndexes()) return books;
+    while (!index.complete) {
+        if (!extendFuzzyIndex(index, batchSql, INT_MAX, keysLoaded)) return books;
+    }
+    
+    std::vector<FuzzyKeySet::Match> matches = index.keys.find(foldText(query), maxDistance);
+    if (matches.empty()) return books;
+    
+    std::string sql = kSelectBooks + " WHERE " + keyCondition + " ORDER BY b.title;";
+    sqlite3_stmt* stmt;
+    size_t photoAllowance = resultPhotoLimit;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        for (const FuzzyKeySet::Match& match : matches) {
+            sqlite3_bind_text(stmt, 1, match.value.c_str(), -1, SQLITE_STATIC);
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                books.push_back(rowToBook(stmt));
+                fitPhoto(books.back(), photoAllowance);
+            }
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+    }
+    enforceMemoryBudget();
+    return books;
+}
+
+std::vector<Book> Database::searchByAuthorFuzzy(const std::string& author, int maxDistance) {
+    return searchFuzzy(authorFuzzyIndex, kAuthorKeyBatch,
+                       "b.author_id IN (SELECT id FROM authors WHERE name_key=?)", author, maxDistance);
+}
+
+std::vector<Book> Database::searchByTitleFuzzy(const std::string& title, int maxDistance) {
+    return searchFuzzy(titleFuzzyIndex, kTitleKeyBatch, "b.title_key=?", title, maxDistance);
+}
+
+std::vector<Book> Database::searchByAuthorPhonetic(const std::string& author) {
+    std::vector<Book> books;
+    std::vector<std::string> codes = phoneticCodes(author);
+    if (codes.empty()) return books;
+    
+    // Every word of the query must sound like some word of the author
+    std::stringstream sql;
+    sql << kSelectBooks << " WHERE 1=1";
+    for (size_t i = 0; i < codes.size(); i++) {
+        sql << " AND b.author_id IN (SELECT author_id FROM author_phonetic WHERE code=?)";
+    }
+    sql << " ORDER BY b.title;";
+    
+    sqlite3_stmt* stmt;
+    size_t photoAllowance = resultPhotoLimit;
+    if (sqlite3_prepare_v2(db, sql.str().c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        for (size_t i = 0; i < codes.size(); i++) {
+            sqlite3_bind_text(stmt, static_cast<int>(i + 1), codes[i].c_str(), -1, SQLITE_TRANSIENT);
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
             books.push_back(rowToBook(stmt));
+            fitPhoto(books.back(), photoAllowance);
+        }
+        sqlite3_finalize(stmt);
+    }
+    enforceMemoryBudget();
+    return books;
+}
+
+std::vector<DuplicateCluster> Database::findDuplicates(double minSimilarity) {
+    DuplicateDetector detector;
+    const char* sql = "SELECT b.id, a.name_key, b.title_key FROM books b JOIN authors a ON a.id = b.author_id;";
+    sqlite3_stmt* stmt;
+    
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return {};
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* author = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        const char* title = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        std::string text = std::string(author ? author : "") + " " + (title ? title : "");
+        detector.add(sqlite3_column_int(stmt, 0), text);
+    }
+    sqlite3_finalize(stmt);
+    return detector.findClusters(minSimilarity);
+}
+
+long long Database::getChangeVersion() {
+    long long version = 0;
+    const char* sql = "SELECT seq FROM sqlite_sequence WHERE name='book_changes';";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) version = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    return version;
+}
+
+int Database::getSchemaVersion() {
+    int version = 0;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "PRAGMA schema_version;", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) version = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    return version;
+}
+
+bool Database::getChangesSince(long long sinceVersion, std::vector<BookChange>& changes) {
+    changes.clear();
+    
+    long long oldest = 0;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "SELECT MIN(version) FROM book_changes;", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) oldest = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    if (sinceVersion < getChangeVersion() && (oldest == 0 || sinceVersion + 1 < oldest)) {
+        return false;
+    }
+    
+    const char* sql = "SELECT version, book_id, op FROM book_changes WHERE version > ? ORDER BY version;";
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    sqlite3_bind_int64(stmt, 1, sinceVersion);
+    
+    // Collapse to one entry per book: a row inserted and then edited is still an insert
+    std::unordered_map<int, size_t> byBook;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        BookChange change;
+        change.version = sqlite3_column_int64(stmt, 0);
+        change.bookId = sqlite3_column_int(stmt, 1);
+        change.op = static_cast<BookChange::Op>(sqlite3_column_int(stmt, 2));
+        
+        auto it = byBook.find(change.bookId);
+        if (it == byBook.end()) {
+            byBook[change.bookId] = changes.size();
+            changes.push_back(change);
+            continue;
+        }
+        BookChange& existing = changes[it->second];
+        existing.version = change.version;
+        if (!(existing.op == BookChange::Insert && change.op == BookChange::Update)) {
+            existing.op = change.op;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+bool Database::queryInt(const char* sql, long long& value) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) value = sqlite3_column_int64(stmt, 0);
+    else lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+bool Database::getFreeSpaceStats(FreeSpaceStats& stats) {
+    long long mode = 0;
+    bool success = queryInt("PRAGMA page_size;", stats.pageSize) &&
+                   queryInt("PRAGMA page_count;", stats.pageCount) &&
+                   queryInt("PRAGMA freelist_count;", stats.freePages) &&
+                   queryInt("PRAGMA auto_vacuum;", mode);
+    stats.autoVacuum = static_cast<FreeSpaceStats::AutoVacuum>(mode);
+    return success;
+}
+
+bool Database::enableIncrementalVacuum() {
+    FreeSpaceStats stats;
+    if (!getFreeSpaceStats(stats)) return false;
+    if (stats.autoVacuum == FreeSpaceStats::Incremental) return true;
+    
+    // Switching from none needs the full rebuild; from full it is only a header flag
+    if (!execSql("PRAGMA auto_vacuum=INCREMENTAL;")) return false;
+    return stats.autoVacuum == FreeSpaceStats::Full || execSql("VACUUM;");
+}
+
+bool Database::incrementalVacuum(int maxPages, int& freedPages) {
+    freedPages = 0;
+    FreeSpaceStats before;
+    if (!getFreeSpaceStats(before)) return false;
+    if (before.autoVacuum != FreeSpaceStats::Incremental) {
+        lastError = "auto_vacuum is not INCREMENTAL";
+        return false;
+    }
+    if (before.freePages == 0 || maxPages <= 0) return true;
+    
+    // One page is moved per step; the whole pragma is one short write transaction
+    std::string sql = "PRAGMA incremental_vacuum(" + std::to_string(maxPages) + ");";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {}
+    bool success = rc == SQLITE_DONE;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    
+    long long remaining = before.freePages;
+    if (success && queryInt("PRAGMA freelist_count;", remaining)) {
+        freedPages = static_cast<int>(before.freePages - remaining);
+    }
+    return success;
+}
+
+void Database::setAnalysisLimit(int rows) {
+    analysisLimit = rows;
+    if (!db) return;
+    std::string sql = "PRAGMA analysis_limit=" + std::to_string(rows) + ";";
+    execSql(sql.c_str());
+}
+
+bool Database::optimize() {
+    return execSql("PRAGMA optimize;");
+}
+
+bool Database::analyze() {
+    // A full pass ignores analysis_limit, so the limit is lifted for it
+    execSql("PRAGMA analysis_limit=0;");
+    bool success = execSql("ANALYZE;");
+    setAnalysisLimit(analysisLimit);
+    return success;
+}
+
+// Runs as its own pass rather than from the delete triggers: upsertBooks() holds the
+// ids it resolved for the whole call, and a name freed early in a bulk import is
+// usually needed again a few rows later.
+bool Database::pruneNames(int& removed) {
+    removed = 0;
+    const char* statements[] = {
+        "DELETE FROM author_phonetic WHERE author_id IN "
+        "(SELECT id FROM authors a WHERE NOT EXISTS (SELECT 1 FROM books WHERE author_id = a.id));",
+        "DELETE FROM authors WHERE NOT EXISTS (SELECT 1 FROM books WHERE author_id = authors.id);",
+        "DELETE FROM publishers WHERE NOT EXISTS (SELECT 1 FROM books WHERE publisher_id = publishers.id);",
+    };
+    if (!execSql("SAVEPOINT prune_names;")) return false;
+    
+    bool success = true;
+    for (size_t i = 0; success && i < sizeof(statements) / sizeof(statements[0]); i++) {
+        success = execSql(statements[i]);
+        if (success && i > 0) removed += sqlite3_changes(db);
+    }
+    
+    if (success) return execSql("RELEASE prune_names;");
+    execSql("ROLLBACK TO prune_names; RELEASE prune_names;");
+    removed = 0;
+    return false;
+}
+
+bool Database::getPlannerStats(std::vector<PlannerStat>& stats) {
+    stats.clear();
+    if (!hasTable("sqlite_stat1")) return true;
+    
+    const char* sql = "SELECT tbl, idx, stat FROM sqlite_stat1 ORDER BY tbl, idx;";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        PlannerStat stat;
+        const char* index = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        const char* values = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        stat.table = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        if (index) stat.index = index;
+        if (values) {
+            std::istringstream fields(values);
+            fields >> stat.rows;
+            long long perKey;
+            while (fields >> perKey) stat.rowsPerKey.push_back(perKey);
+        }
+        stats.push_back(std::move(stat));
+    }
+    sqlite3_finalize(stmt);
+    return true;
+}
+
+bool Database::getLookasideStats(LookasideStats& stats) {
+    stats = LookasideStats();
+    int unused = 0;
+    bool success = sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_USED, &stats.slotsUsed, &stats.slotsPeak, 0) == SQLITE_OK &&
+                   sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_HIT, &unused, &stats.hits, 0) == SQLITE_OK &&
+                   sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &unused, &stats.missesSize, 0) == SQLITE_OK &&
+                   sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &unused, &stats.missesFull, 0) == SQLITE_OK;
+    if (!success) lastError = "Lookaside statistics unavailable";
+    return success;
+}
+
+bool Database::backupTo(const std::string& path, const std::function<bool(const BackupProgress&)>& progress,
+                        int pagesPerStep, int pauseMs) {
+    sqlite3* dest;
+    if (sqlite3_open_v2(path.c_str(), &dest, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(dest);
+        sqlite3_close(dest);
+        return false;
+    }
+    sqlite3_backup* backup = sqlite3_backup_init(dest, "main", db, "main");
+    if (!backup) {
+        lastError = sqlite3_errmsg(dest);
+        sqlite3_close(dest);
+        return false;
+    }
+    
+    bool cancelled = false;
+    int rc;
+    do {
+        rc = sqlite3_backup_step(backup, pagesPerStep > 0 ? pagesPerStep : -1);
+        if (rc != SQLITE_OK && rc != SQLITE_DONE && rc != SQLITE_BUSY && rc != SQLITE_LOCKED) break;
+        
+        BackupProgress step;
+        step.remainingPages = sqlite3_backup_remaining(backup);
+        step.totalPages = sqlite3_backup_pagecount(backup);
+        if (progress && !progress(step)) {
+            cancelled = true;
+            break;
+        }
+        if (rc != SQLITE_DONE && pauseMs > 0) std::this_thread::sleep_for(std::chrono::milliseconds(pauseMs));
+    } while (rc != SQLITE_DONE);
+    
+    // Finishing early rolls back what was written to the destination
+    sqlite3_backup_finish(backup);
+    bool success = rc == SQLITE_DONE && !cancelled;
+    if (cancelled) lastError = "Backup cancelled";
+    else if (!success) lastError = sqlite3_errstr(rc);
+    sqlite3_close(dest);
+    return success;
+}
+
+bool Database::vacuumInto(const std::string& path) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "VACUUM INTO ?;", -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_TRANSIENT);
+    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!success) lastError = sqlite3_errmsg(db);
+    sqlite3_finalize(stmt);
+    return success;
+}
+
+void Database::onRowChange(void* self, int /*op*/, const char* /*dbName*/, const char* table, sqlite3_int64 rowid) {
+    // Runs inside sqlite3_step; only records the row, the cache is checked on next use
+    if (strcmp(table, "books") != 0) return;
+    Database* database = static_cast<Database*>(self);
+    database->bookCache.erase(static_cast<int>(rowid));
+    if (database->searchCache.empty() || database->changedBooksOverflow) return;
+    if (database->changedBookIds.size() >= kMaxTrackedChanges) {
+        database->changedBooksOverflow = true;
+        database->changedBookIds.clear();
+        return;
+    }
+    database->changedBookIds.push_back(static_cast<int>(rowid));
+}
+
+void Database::setSearchCacheCapacity(size_t entries) {
+    searchCacheCapacity = entries;
+    while (searchCache.size() > searchCacheCapacity ||
+           (!searchCache.empty() && searchCacheBytes() > searchCacheByteLimit)) {
+        searchCacheIndex.erase(searchCache.back().key);
+        searchCache.pop_back();
+    }
+    searchCacheStats.entries = searchCache.size();
+}
+
+void Database::clearSearchCache() {
+    searchCache.clear();
+    searchCacheIndex.clear();
+    changedBookIds.clear();
+    changedBooksOverflow = false;
+    searchCacheStats.entries = 0;
+}
+
+void Database::syncBookCache() {
+    // Our own writes evict rows through the update hook; other connections' commits
+    // only show up as a data_version change
+    int version = queryDataVersion();
+    if (version != bookCacheDataVersion) {
+        bookCache.clear();
+        bookCacheDataVersion = version;
+    }
+}
+
+void Database::setBookCacheBudget(size_t bytes) {
+    bookCache.setBudget(bytes);
+}
+
+void Database::fitPhoto(Book& book, size_t& allowance) {
+    if (book.photo.size() <= allowance) {
+        allowance -= book.photo.size();
+        return;
+    }
+    std::vector<unsigned char>().swap(book.photo);
+    book.photoOmitted = true;
+}
+
+size_t Database::searchCacheBytes() const {
+    size_t bytes = 0;
+    for (const CachedSearch& entry : searchCache) {
+        bytes += entry.ids.capacity() * sizeof(int) + entry.key.capacity();
+    }
+    return bytes;
+}
+
+void Database::setMemoryBudget(size_t bytes) {
+    memoryBudget = bytes;
+    applyMemoryBudget();
+}
+
+void Database::applyMemoryBudget() {
+    size_t sqliteBytes = static_cast<size_t>(memoryBudget * kSqliteBudgetShare);
+    resultPhotoLimit = memoryBudget ? static_cast<size_t>(memoryBudget * kResultPhotoBudgetShare) : SIZE_MAX;
+    searchCacheByteLimit = memoryBudget ? static_cast<size_t>(memoryBudget * kSearchCacheBudgetShare) : SIZE_MAX;
+    bookCache.setBudget(memoryBudget ? static_cast<size_t>(memoryBudget * kBookCacheBudgetShare) : kDefaultBookCacheBytes);
+    setSearchCacheCapacity(searchCacheCapacity);
+    
+    // No soft heap limit: SQLite only enforces one with memory statistics on, which
+    // configureSqliteMemory() turns off. cache_size bounds the page cache, and the
+    // pool's own counters let enforceMemoryBudget() see the rest.
+    if (!db) return;
+    long long cacheKiB = memoryBudget ? std::max<long long>(static_cast<long long>(sqliteBytes / 1024), 64) : kDefaultCacheSizeKiB;
+    std::string sql = "PRAGMA cache_size=-" + std::to_string(cacheKiB) + ";";
+    execSql(sql.c_str());
+}
+
+MemoryUsage Database::getMemoryUsage() {
+    MemoryUsage usage;
+    // Pages in the preallocated slots are not pool allocations; overflow pages are
+    SqliteMemoryStats sqliteStats = getSqliteMemoryStats();
+    usage.sqliteHeap = sqliteStats.pooled
+        ? sqliteStats.bytesInUse + sqliteStats.pageCacheSlotsUsed * sqliteStats.pageCacheSlotBytes
+        : sqlite3_memory_used();
+    int current = 0, peak = 0;
+    if (db && sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_USED, &current, &peak, 0) == SQLITE_OK) {
+        usage.pageCache = current;
+    }
+    usage.bookCache = bookCache.stats().bytes;
+    usage.searchCache = searchCacheBytes();
+    usage.fuzzyIndexes = authorFuzzyIndex.keys.memoryBytes() + titleFuzzyIndex.keys.memoryBytes();
+    return usage;
+}
+
+size_t Database::shedMemory(size_t targetBytes) {
+    MemoryUsage before = getMemoryUsage();
+    auto over = [&]() { return getMemoryUsage().total() > static_cast<long long>(targetBytes); };
+    
+    // Names no cached book or list row refers to any more; not part of MemoryUsage
+    InternedString::purgePool();
+    if (over()) clearSearchCache();
+    if (over()) {
+        resetFuzzyIndexes();
+        fuzzyWanted = false;
+    }
+    if (over()) bookCache.clear();
+    if (over() && db) sqlite3_db_release_memory(db);
+    
+    long long freed = before.total() - getMemoryUsage().total();
+    return freed > 0 ? static_cast<size_t>(freed) : 0;
+}
+
+void Database::enforceMemoryBudget() {
+    if (memoryBudget && getMemoryUsage().total() > static_cast<long long>(memoryBudget)) shedMemory(memoryBudget);
+}
+
+SearchCacheStats Database::getSearchCacheStats() const {
+    return searchCacheStats;
+}
+
+void Database::syncSearchCache() {
+    // data_version only moves when another connection commits; our own writes are
+    // reported row by row through the update hook
+    int version = queryDataVersion();
+    if (version != searchCacheDataVersion || changedBooksOverflow) {
+        searchCacheStats.invalidations += searchCache.size();
+        clearSearchCache();
+        searchCacheDataVersion = version;
+        return;
+    }
+    if (changedBookIds.empty()) return;
+    
+    std::sort(changedBookIds.begin(), changedBookIds.end());
+    changedBookIds.erase(std::unique(changedBookIds.begin(), changedBookIds.end()), changedBookIds.end());
+    
+    // A changed row that no longer matches is removed from the list in place. One that
+    // matches may be new or may have moved, so the entry is dropped.
+    for (auto it = searchCache.begin(); it != searchCache.end();) {
+        std::string sql = "SELECT 1 FROM books b WHERE b.id=? AND (" + it->where + ");";
+        sqlite3_stmt* stmt;
+        bool drop = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK;
+        std::vector<int> removed;
+        for (size_t i = 0; !drop && i < changedBookIds.size(); i++) {
+            int id = changedBookIds[i];
+            sqlite3_bind_int(stmt, 1, id);
+            bindArgs(stmt, it->args, 2);
+            bool matches = sqlite3_step(stmt) == SQLITE_ROW;
+            sqlite3_reset(stmt);
+            if (matches) drop = true;
+            else removed.push_back(id);
         }
         sqlite3_finalize(stmt);
+        
+        if (drop) {
+            searchCacheStats.invalidations++;
+            searchCacheIndex.erase(it->key);
+            it = searchCache.erase(it);
+            continue;
+        }
+        std::vector<int>& ids = it->ids;
+        ids.erase(std::remove_if(ids.begin(), ids.end(), [&](int id) {
+            return std::binary_search(removed.begin(), removed.end(), id);
+        }), ids.end());
+        ++it;
+    }
+    changedBookIds.clear();
+    searchCacheStats.entries = searchCache.size();
+}
+
+std::vector<Book> Database::cachedSearch(const std::string& where, const std::vector<SqlArg>& args, const char* orderBy) {
+    syncSearchCache();
+    
+    // Text arguments are already folded, so "Tolkien" and "tolkien" share an entry
+    std::string key = where + '\x1f' + orderBy;
+    for (const SqlArg& arg : args) {
+        key += '\x1f';
+        key += arg.isText ? arg.text : std::to_string(arg.number);
+    }
+    
+    auto found = searchCacheIndex.find(key);
+    if (found != searchCacheIndex.end()) {
+        searchCacheStats.hits++;
+        searchCache.splice(searchCache.begin(), searchCache, found->second);
+        return getBooks(found->second->ids);
     }
+    searchCacheStats.misses++;
+    
+    std::vector<Book> books;
+    std::string sql = kSelectBooks + " WHERE " + where + " ORDER BY " + orderBy + ";";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        lastError = sqlite3_errmsg(db);
+        return books;
+    }
+    bindArgs(stmt, args, 1);
+    int rc;
+    size_t photoAllowance = resultPhotoLimit;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        books.push_back(rowToBook(stmt));
+        fitPhoto(books.back(), photoAllowance);
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE || searchCacheCapacity == 0 || books.size() > kMaxCachedResult) return books;
+    
+    CachedSearch entry;
+    entry.key = key;
+    entry.where = where;
+    entry.args = args;
+    for (const Book& book : books) entry.ids.push_back(book.id);
+    searchCache.push_front(std::move(entry));
+    searchCacheIndex[key] = searchCache.begin();
+    setSearchCacheCapacity(searchCacheCapacity);
+    enforceMemoryBudget();
     return books;
 }
@@ -1,20 +1,134 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
+#include <list>
 #include <memory>
+#include <unordered_map>
+#include <iosfwd>
 #include "sqlite3.h"
+#include "book.h"
+#include "bookcache.h"
+#include "fuzzy.h"
+#include "dedup.h"
+#include "thumbnail.h"
 
-struct Book {
-    int id = 0;
+// Filter set used by searchAdvanced and the aggregate queries; empty/zero fields are ignored
+struct BookFilter {
+    std::string author;
+    std::string title;
+    int yearFrom = 0;
+    int yearTo = 0;
+    std::string publisher;
+};
+
+// Values written by updateWhere; empty/zero fields are left unchanged
+struct BookUpdate {
     std::string author;
     std::string title;
     int year = 0;
     int pages = 0;
     std::string publisher;
-    std::vector<unsigned char> photo;
-    std::string photoPath;
+};
+
+struct UpsertResult {
+    int inserted = 0;
+    int updated = 0;
+    int unchanged = 0;
+};
+
+struct FacetCount {
+    std::string value;
+    int count = 0;
+};
+
+struct BookFacets {
+    int total = 0;
+    std::vector<FacetCount> authors;
+    std::vector<FacetCount> publishers;
+    std::vector<FacetCount> decades;    // "1990s", ...; books without a year are not counted
+};
+
+// Per-book values a list view sorts on; author and publisher are dictionary ids
+struct BookSortKey {
+    int id = 0;
+    int authorId = 0;
+    int publisherId = 0;    // 0 = no publisher
+    int year = 0;
+    int pages = 0;
+    std::string title;
+};
+
+struct SearchCacheStats {
+    size_t entries = 0;
+    long long hits = 0;
+    long long misses = 0;
+    long long invalidations = 0;    // Entries dropped because books changed
+};
+
+struct BackupProgress {
+    int remainingPages = 0;
+    int totalPages = 0;
+};
+
+struct FreeSpaceStats {
+    enum AutoVacuum { None = 0, Full = 1, Incremental = 2 };
+    long long pageSize = 0;
+    long long pageCount = 0;
+    long long freePages = 0;        // Pages on the freelist, reusable but still in the file
+    AutoVacuum autoVacuum = None;
+    
+    long long freeBytes() const { return freePages * pageSize; }
+    double freeRatio() const { return pageCount > 0 ? static_cast<double>(freePages) / pageCount : 0.0; }
+};
+
+// One sqlite_stat1 row: estimated rows in the table/index and, per index column
+// prefix, the average number of rows sharing a value
+struct PlannerStat {
+    std::string table;
+    std::string index;              // Empty for the table row count
+    long long rows = 0;
+    std::vector<long long> rowsPerKey;
+};
+
+// Lookaside use of this connection (slot sizes are set by configureSqliteMemory)
+struct LookasideStats {
+    int slotsUsed = 0;
+    int slotsPeak = 0;
+    int hits = 0;
+    int missesSize = 0;             // Requests larger than a slot
+    int missesFull = 0;             // Requests made while every slot was taken
+};
+
+// Approximate bytes held per subsystem
+struct MemoryUsage {
+    long long sqliteHeap = 0;       // All of SQLite, process-wide; 0 without the pool or memStatus
+    long long pageCache = 0;        // This connection's page cache
+    size_t bookCache = 0;
+    size_t searchCache = 0;
+    size_t fuzzyIndexes = 0;
+    
+    long long total() const {
+        long long sqlite = sqliteHeap > 0 ? sqliteHeap : pageCache;
+        return sqlite + static_cast<long long>(bookCache + searchCache + fuzzyIndexes);
+    }
+};
+
+struct MigrationStatus {
+    int userVersion = 0;            // Last migration applied to the file (PRAGMA user_version)
+    int latestVersion = 0;          // Last migration this build knows
+    int pendingBackfills = 0;
+    long long backfillRemaining = 0;    // Book ids the pending backfills have yet to cover
+};
+
+struct BookChange {
+    enum Op { Insert = 1, Update = 2, Delete = 3 };
+    long long version = 0;
+    int bookId = 0;
+    Op op = Update;
 };
 
 class Database {
@@ -26,13 +140,42 @@ public:
     void close();
     bool isOpen() const { return db != nullptr; }
     
+    // Read-only second connection for work off the UI thread (list reconciliation).
+    // Nothing is migrated or written; the main connection's open() has done that.
+    // Either side waits up to a few seconds for the other's lock instead of failing.
+    bool openReader(const std::string& dbPath);
+    
     // CRUD operations
     bool addBook(const Book& book);
     bool updateBook(const Book& book);
     bool deleteBook(int id);
-    Book getBook(int id);
+    Book getBook(int id, bool includePhoto = true);
+    
+    // Many rows in one pass, in request order; ids that do not exist are skipped
+    std::vector<Book> getBooks(const std::vector<int>& ids, bool includePhoto = true);
+    
+    // Exact lookup on the unique ISBN index (values from parseIsbn); id 0 if not found.
+    // The batch form serves scanner bursts: results in request order, unknown codes skipped.
+    Book getBookByIsbn(long long isbn);
+    std::vector<Book> getBooksByIsbn(const std::vector<long long>& isbns);
     
-    // Search operations
+    // Streams the books matching a filter in id order, one row in memory at a time;
+    // visit returns false to stop early. Used by exports and other full passes.
+    bool forEachBook(const BookFilter& filter, bool includePhoto, const std::function<bool(const Book&)>& visit);
+
+    // Set-based bulk changes, each in one transaction; affected receives the number of
+    // books written. An empty filter is rejected rather than matching every book.
+    bool updateWhere(const BookFilter& filter, const BookUpdate& update, int& affected);
+    bool deleteWhere(const BookFilter& filter, int& affected);
+    bool deleteBooks(const std::vector<int>& ids, int& affected);
+    
+    // Merge import keyed on ISBN, or folded author + title + year: matching books are
+    // updated in place (an empty photo or ISBN keeps the stored one), others are
+    // inserted, and unchanged ones are not written at all. Each batch of rows is one transaction;
+    // on failure the batches before it stay committed and are counted in result.
+    bool upsertBooks(const std::vector<Book>& books, UpsertResult& result);
+    
+    // Search operations (text filters are case/diacritic-insensitive substring matches)
     std::vector<Book> getAllBooks();
     std::vector<Book> searchByAuthor(const std::string& author);
     std::vector<Book> searchByTitle(const std::string& title);
@@ -41,15 +184,239 @@ public:
     std::vector<Book> searchByPublisher(const std::string& publisher);
     std::vector<Book> searchAdvanced(const std::string& author, const std::string& title,
                                       int yearFrom, int yearTo, const std::string& publisher);
+    std::vector<Book> searchAdvanced(const BookFilter& filter);
+    
+    // Cover previews (thumbnail.h), kept in their own table so grid queries never read
+    // the photo column. A preview is rendered when a photo is stored through this
+    // connection; photos from other connections, or ones whose preview is still
+    // pending, are rendered on first fetch and stored. Results follow request order;
+    // books without a photo, or with one no decoder understands, are skipped.
+    bool getThumbnails(const std::vector<int>& ids, std::vector<Thumbnail>& thumbnails);
+    
+    // Sort keys of the books matching a filter, in table order; lets list views hold
+    // and re-sort a result set without loading the rows
+    bool getSortKeys(const BookFilter& filter, std::vector<BookSortKey>& keys);
+    bool getSortKeys(const std::vector<int>& ids, std::vector<BookSortKey>& keys);
+    
+    // Position of every author/publisher in name order, indexed by dictionary id
+    // (unused ids hold UINT32_MAX)
+    bool getNameRanks(std::vector<uint32_t>& authorRanks, std::vector<uint32_t>& publisherRanks);
+    
+    // Result counts (same matching rules as the searches above); no rows are returned.
+    // A single year, author or publisher filter is counted from its index alone; a
+    // title filter or a combination of filters still looks up each candidate row.
+    // -1 on failure, with getLastError() set.
+    int countAll();
+    int countAdvanced(const BookFilter& filter);
+    
+    // Grouped counts for a filter, most frequent first (maxValues 0 = all values)
+    BookFacets getFacets(const BookFilter& filter, size_t maxValues = 20);
+    
+    // Typo-tolerant search: books whose folded author/title is within maxDistance edits
+    // of the query, nearest first
+    std::vector<Book> searchByAuthorFuzzy(const std::string& author, int maxDistance = 2);
+    std::vector<Book> searchByTitleFuzzy(const std::string& title, int maxDistance = 2);
+    
+    // Loads up to batchKeys more keys into each fuzzy index, in key order, so the indexes
+    // can be filled in idle slices; a search finds whatever is left. done is set once
+    // both are complete, or when they were dropped by shedMemory() and no fuzzy search
+    // has asked for them since.
+    bool buildFuzzyIndexes(int batchKeys, int& keysLoaded, bool& done);
+    
+    // Sound-alike search: every word of the query must match an author word phonetically
+    std::vector<Book> searchByAuthorPhonetic(const std::string& author);
+    
+    // Candidate duplicate records by estimated similarity of folded author + title
+    std::vector<DuplicateCluster> findDuplicates(double minSimilarity = 0.8);
+    
+    // Change journal: every insert/update/delete of a book bumps the version.
+    // getChangesSince returns one entry per changed book; it returns false when the
+    // journal no longer reaches back to sinceVersion and a full reload is needed.
+    long long getChangeVersion();
+    bool getChangesSince(long long sinceVersion, std::vector<BookChange>& changes);
+    
+    // PRAGMA schema_version: changes with every schema change, kept in the file
+    int getSchemaVersion();
+    
+    // Schema migrations. open() applies the ones newer than the file's user_version in
+    // order, each in its own transaction, and refuses files from a newer build. A
+    // migration that has to rewrite existing books only records a backfill there;
+    // runMigrationBatch() then rewrites up to batchSize books (by id) per transaction,
+    // saving its position in the same commit, so the work can be spread over idle
+    // time and survives a restart. done is set once no backfill is left.
+    bool runMigrationBatch(int batchSize, int& booksDone, bool& done);
+    MigrationStatus getMigrationStatus();
+    
+    // Online copy of the open database to path (replaced if it exists). Pages are
+    // copied pagesPerStep at a time with a pause in between, so the read lock is held
+    // only briefly and edits can go on meanwhile; writes through this connection are
+    // carried into the copy, a commit by another connection restarts it. progress is
+    // called after every step and may return false to cancel.
+    bool backupTo(const std::string& path, const std::function<bool(const BackupProgress&)>& progress = nullptr,
+                  int pagesPerStep = 256, int pauseMs = 10);
+    
+    // Compacted, defragmented copy through VACUUM INTO; path must not exist yet.
+    // Runs as one read transaction, so it is slower to finish than backupTo but
+    // produces the smallest file.
+    bool vacuumInto(const std::string& path);
+    
+    // Free-space reclamation. New files are created with auto_vacuum=INCREMENTAL;
+    // enableIncrementalVacuum() converts an existing one (a full VACUUM when it had
+    // auto_vacuum off). incrementalVacuum() returns up to maxPages freelist pages to
+    // the file system in one short transaction.
+    bool getFreeSpaceStats(FreeSpaceStats& stats);
+    bool enableIncrementalVacuum();
+    bool incrementalVacuum(int maxPages, int& freedPages);
+    
+    // Query planner statistics. PRAGMA optimize runs on open (including tables never
+    // analyzed) and on close, sampling at most analysisLimit rows per index; optimize()
+    // is the same pass for periodic use, analyze() a full unsampled ANALYZE.
+    void setAnalysisLimit(int rows);
+    bool optimize();
+    bool analyze();
+    bool getPlannerStats(std::vector<PlannerStat>& stats);
+    
+    // Deletes and renames leave authors and publishers no book refers to any more;
+    // pruneNames() removes them (with their phonetic keys) in one transaction.
+    bool pruneNames(int& removed);
+    
+    bool getLookasideStats(LookasideStats& stats);
+    
+    // Full getBook() results are kept in a 2Q cache bounded by approximate bytes.
+    // Rows written through this connection are evicted as they change; a commit by
+    // another connection clears the cache.
+    void setBookCacheBudget(size_t bytes);
+    BookCacheStats getBookCacheStats() const { return bookCache.stats(); }
+    
+    // Repeated searchBy*/searchAdvanced calls are answered from an LRU of id lists.
+    // Entries are re-checked against the rows this connection changed, and dropped
+    // wholesale when another connection commits.
+    void setSearchCacheCapacity(size_t entries);
+    void clearSearchCache();
+    SearchCacheStats getSearchCacheStats() const;
+    
+    // Memory budget (0 = unlimited). The budget is split between SQLite (this
+    // connection's cache_size), the book cache, the search cache and the photo
+    // bytes a single result list may carry; rows past that allowance come
+    // with photoOmitted set. When the total still exceeds the budget after a search,
+    // or shedMemory() is called on memory pressure, caches are freed in order of how
+    // cheaply they come back: search results, fuzzy indexes, the book cache, then
+    // SQLite's page cache, stopping once usage is at or below targetBytes.
+    void setMemoryBudget(size_t bytes);
+    MemoryUsage getMemoryUsage();
+    size_t shedMemory(size_t targetBytes = 0);
     
     std::string getLastError() const { return lastError; }
 
 private:
     sqlite3* db = nullptr;
+    bool readOnly = false;
     std::string lastError;
+    sqlite3_stmt* dataVersionStmt = nullptr;
+    int analysisLimit = 1000;           // Rows sampled per index; tens of ms on a million books
+    size_t memoryBudget = 0;
+    size_t resultPhotoLimit = SIZE_MAX;     // Photo bytes per result list
+    size_t searchCacheByteLimit = SIZE_MAX;
+    
+    BookCache bookCache;
+    int bookCacheDataVersion = 0;
+    
+    // Distinct author/title keys for fuzzy search with their book counts, loaded in key
+    // order up to cursor. This connection's writes reach them through temp triggers
+    // (temp.fuzzy_changes, drained once committed); another connection's commit makes
+    // them start over.
+    struct FuzzyIndex {
+        FuzzyKeySet keys;
+        std::string cursor;
+        bool complete = false;
+    };
+    FuzzyIndex authorFuzzyIndex;
+    FuzzyIndex titleFuzzyIndex;
+    int fuzzyDataVersion = 0;
+    bool fuzzyTracking = false;
+    bool fuzzyWanted = true;
+    
+    struct SqlArg {
+        bool isText;
+        std::string text;
+        int number;
+    };
+    
+    // Search results by normalized query; where/args are kept to re-check changed rows
+    struct CachedSearch {
+        std::string key;
+        std::string where;
+        std::vector<SqlArg> args;
+        std::vector<int> ids;
+    };
+    std::list<CachedSearch> searchCache;
+    std::unordered_map<std::string, std::list<CachedSearch>::iterator> searchCacheIndex;
+    size_t searchCacheCapacity = 64;
+    SearchCacheStats searchCacheStats;
+    int searchCacheDataVersion = 0;
+    std::vector<int> changedBookIds;    // From the update hook since the last sync
+    bool changedBooksOverflow = false;
+    
+    // One schema step: apply runs inside the migration's transaction; backfill, if
+    // set, later rewrites the books in an id range that backfillRange selected
+    struct Migration {
+        int version;
+        const char* name;
+        bool (Database::*apply)();
+        const char* backfillRange;      // SELECT first id, last id
+        bool (Database::*backfill)(long long fromId, long long toId);
+    };
+    static const Migration kMigrations[];
     
-    bool createTables();
+    bool execSql(const char* sql);
+    bool queryInt(const char* sql, long long& value);
+    bool hasColumn(const char* table, const char* column);
+    bool hasTable(const char* table);
+    bool migrate();
+    bool scheduleBackfill(const Migration& migration);
+    bool createBaseSchema();
+    bool pruneChangeJournal();
+    bool migrateToDictionaries();
+    bool rebuildPhoneticIndex();
+    bool assignNaturalKeys(long long fromId, long long toId);
+    bool trackNaturalKeys();
+    bool assignFreedNaturalKeys();
+    bool createThumbnailTable();
+    bool buildThumbnails(long long fromId, long long toId);
+    bool renderPendingThumbnails(long long fromId, long long toId);
+    bool renderPendingThumbnails(const std::vector<int>& ids);
+    bool renderThumbnails(const std::vector<int>& ids);
+    bool writePhoneticKeys(int authorId, const std::string& name);
+    int internName(const char* table, const std::string& name, bool& inserted);
+    int internAuthor(const std::string& name);
+    int internPublisher(const std::string& name);
+    bool resolveNames(const Book& book, int& authorId, int& publisherId);
+    void bindBookColumns(sqlite3_stmt* stmt, const Book& book, int authorId, int publisherId);
+    bool checkIsbn(const Book& book);
     Book rowToBook(sqlite3_stmt* stmt);
+    void fitPhoto(Book& book, size_t& allowance);
+    void applyMemoryBudget();
+    void enforceMemoryBudget();
+    size_t searchCacheBytes() const;
+    void appendFilter(std::stringstream& sql, const BookFilter& filter);
+    bool isEmptyFilter(const BookFilter& filter) const;
+    int bindFilter(sqlite3_stmt* stmt, const BookFilter& filter, int idx);
+    std::vector<SqlArg> filterArgs(const BookFilter& filter);
+    int bindArgs(sqlite3_stmt* stmt, const std::vector<SqlArg>& args, int idx);
+    std::vector<Book> cachedSearch(const std::string& where, const std::vector<SqlArg>& args, const char* orderBy);
+    void syncSearchCache();
+    void syncBookCache();
+    static void onRowChange(void* self, int op, const char* dbName, const char* table, sqlite3_int64 rowid);
+    BookSortKey rowToSortKey(sqlite3_stmt* stmt);
+    bool loadNameRanks(const char* sql, std::vector<uint32_t>& ranks);
+    bool loadNames(const char* sql, std::vector<InternedString>& names);
+    int countRows(const std::string& sql, const BookFilter* filter);
+    int queryDataVersion();
+    void resetFuzzyIndexes();
+    bool syncFuzzyIndexes();
+    bool extendFuzzyIndex(FuzzyIndex& index, const char* batchSql, int batchKeys, int& keysLoaded);
+    std::vector<Book> searchFuzzy(FuzzyIndex& index, const char* batchSql, const char* keyCondition,
+                                  const std::string& query, int maxDistance);
 };
 
 #endif // DATABASE_H
@@ -0,0 +1,162 @@
+#include "dedup.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+const size_t kShingleSize = 3;
+
+// Buckets up to this size are compared pairwise; larger ones (very common
+// titles) only against their first member to keep the pass near-linear.
+const size_t kMaxPairwiseBucket = 64;
+
+uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+uint64_t hashShingle(const char* data, size_t size) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 0x100000001B3ull;
+    }
+    return splitmix64(h);
+}
+
+struct UnionFind {
+    std::vector<size_t> parent;
+    std::vector<double> weakest;
+
+    explicit UnionFind(size_t n) : parent(n), weakest(n, 1.0) {
+        for (size_t i = 0; i < n; i++) parent[i] = i;
+    }
+
+    size_t find(size_t x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    }
+
+    void unite(size_t a, size_t b, double similarity) {
+        a = find(a);
+        b = find(b);
+        parent[b] = a;
+        weakest[a] = std::min({weakest[a], weakest[b], similarity});
+    }
+};
+
+} // namespace
+
+DuplicateDetector::DuplicateDetector(int bands, int rowsPerBand)
+    : bands(bands), rowsPerBand(rowsPerBand), numHashes(bands * rowsPerBand) {
+    uint64_t state = 0x2545F4914F6CDD1Dull;
+    for (int i = 0; i < numHashes; i++) {
+        multipliers.push_back(splitmix64(state) | 1);
+        offsets.push_back(splitmix64(state));
+    }
+}
+
+void DuplicateDetector::add(int id, const std::string& text) {
+    // Collapse whitespace runs so spacing differences do not change the shingles
+    std::string normalized;
+    for (char c : text) {
+        bool space = c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        if (!space) normalized += c;
+        else if (!normalized.empty() && normalized.back() != ' ') normalized += ' ';
+    }
+    if (!normalized.empty() && normalized.back() == ' ') normalized.pop_back();
+
+    std::vector<uint32_t> mins(numHashes, std::numeric_limits<uint32_t>::max());
+    auto addShingle = [&](uint64_t h) {
+        for (int i = 0; i < numHashes; i++) {
+            uint32_t v = static_cast<uint32_t>((multipliers[i] * h + offsets[i]) >> 32);
+            if (v < mins[i]) mins[i] = v;
+        }
+    };
+
+    if (normalized.size() <= kShingleSize) {
+        addShingle(hashShingle(normalized.data(), normalized.size()));
+    } else {
+        for (size_t i = 0; i + kShingleSize <= normalized.size(); i++) {
+            addShingle(hashShingle(normalized.data() + i, kShingleSize));
+        }
+    }
+
+    ids.push_back(id);
+    for (uint32_t m : mins) signatures.push_back(static_cast<uint16_t>(m));
+}
+
+double DuplicateDetector::similarity(size_t a, size_t b) const {
+    const uint16_t* sa = &signatures[a * numHashes];
+    const uint16_t* sb = &signatures[b * numHashes];
+    int equal = 0;
+    for (int i = 0; i < numHashes; i++) equal += sa[i] == sb[i];
+    return static_cast<double>(equal) / numHashes;
+}
+
+std::vector<DuplicateCluster> DuplicateDetector::findClusters(double minSimilarity) const {
+    const size_t n = ids.size();
+    UnionFind groups(n);
+
+    auto tryJoin = [&](size_t a, size_t b) {
+        if (groups.find(a) == groups.find(b)) return;
+        double s = similarity(a, b);
+        if (s >= minSimilarity) groups.unite(a, b, s);
+    };
+
+    std::vector<std::pair<uint64_t, size_t>> keys(n);
+    for (int band = 0; band < bands; band++) {
+        for (size_t i = 0; i < n; i++) {
+            const uint16_t* rows = &signatures[i * numHashes + band * rowsPerBand];
+            uint64_t key = 0xCBF29CE484222325ull;
+            for (int r = 0; r < rowsPerBand; r++) {
+                key = (key ^ rows[r]) * 0x100000001B3ull;
+            }
+            keys[i] = {key, i};
+        }
+        std::sort(keys.begin(), keys.end());
+
+        for (size_t start = 0; start < n;) {
+            size_t end = start + 1;
+            while (end < n && keys[end].first == keys[start].first) end++;
+
+            if (end - start <= kMaxPairwiseBucket) {
+                for (size_t i = start; i < end; i++) {
+                    for (size_t j = i + 1; j < end; j++) tryJoin(keys[i].second, keys[j].second);
+                }
+            } else {
+                for (size_t j = start + 1; j < end; j++) tryJoin(keys[start].second, keys[j].second);
+            }
+            start = end;
+        }
+    }
+
+    std::vector<size_t> componentSize(n, 0);
+    for (size_t i = 0; i < n; i++) componentSize[groups.find(i)]++;
+
+    std::vector<DuplicateCluster> clusters;
+    std::vector<int> clusterOf(n, -1);
+    for (size_t i = 0; i < n; i++) {
+        size_t root = groups.find(i);
+        if (componentSize[root] < 2) continue;
+        if (clusterOf[root] < 0) {
+            clusterOf[root] = static_cast<int>(clusters.size());
+            clusters.push_back(DuplicateCluster());
+            clusters.back().similarity = groups.weakest[root];
+        }
+        clusters[clusterOf[root]].bookIds.push_back(ids[i]);
+    }
+
+    for (DuplicateCluster& cluster : clusters) {
+        std::sort(cluster.bookIds.begin(), cluster.bookIds.end());
+    }
+    std::sort(clusters.begin(), clusters.end(), [](const DuplicateCluster& a, const DuplicateCluster& b) {
+        return a.similarity != b.similarity ? a.similarity > b.similarity : a.bookIds[0] < b.bookIds[0];
+    });
+    return clusters;
+}
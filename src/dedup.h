@@ -0,0 +1,38 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct DuplicateCluster {
+    std::vector<int> bookIds;
+    double similarity = 0.0;   // Weakest estimated Jaccard similarity that joined the cluster
+};
+
+// Near-duplicate detection with MinHash signatures and LSH banding. Each record's
+// text is split into character 3-gram shingles and summarized by a fixed-size
+// signature (low 16 bits of each min-hash). Records sharing any band of the
+// signature become candidate pairs; only those are compared, so the work grows
+// with the number of records rather than the number of pairs.
+class DuplicateDetector {
+public:
+    explicit DuplicateDetector(int bands = 16, int rowsPerBand = 4);
+
+    void add(int id, const std::string& text);
+    std::vector<DuplicateCluster> findClusters(double minSimilarity) const;
+    size_t size() const { return ids.size(); }
+
+private:
+    int bands;
+    int rowsPerBand;
+    int numHashes;
+    std::vector<uint64_t> multipliers;
+    std::vector<uint64_t> offsets;
+    std::vector<int> ids;
+    std::vector<uint16_t> signatures;   // numHashes entries per record
+
+    double similarity(size_t a, size_t b) const;
+};
+
+#endif // DEDUP_H
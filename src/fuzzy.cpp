@@ -0,0 +1,223 @@
+#include "fuzzy.h"
+#include <algorithm>
+#include <cstring>
+
+EditDistancePattern::EditDistancePattern(const std::string& pattern) : pattern(pattern) {
+    if (!pattern.empty() && pattern.size() <= 64) {
+        peq.assign(256, 0);
+        for (size_t i = 0; i < pattern.size(); i++) {
+            peq[static_cast<unsigned char>(pattern[i])] |= uint64_t(1) << i;
+        }
+    }
+}
+
+int EditDistancePattern::distance(const char* text, size_t size) const {
+    const int m = static_cast<int>(pattern.size());
+    if (m == 0) return static_cast<int>(size);
+    if (size == 0) return m;
+
+    if (!peq.empty()) {
+        // Myers (1999) in Hyyro's formulation: vertical deltas of the DP column are
+        // kept as +1/-1 bit vectors and the score tracks the last row.
+        uint64_t pv = ~uint64_t(0);
+        uint64_t mv = 0;
+        const uint64_t last = uint64_t(1) << (m - 1);
+        int score = m;
+
+        for (size_t j = 0; j < size; j++) {
+            uint64_t eq = peq[static_cast<unsigned char>(text[j])];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            if (ph & last) score++;
+            else if (mh & last) score--;
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+        return score;
+    }
+
+    std::vector<int> row(m + 1);
+    for (int i = 0; i <= m; i++) row[i] = i;
+    for (size_t j = 0; j < size; j++) {
+        int diag = row[0];
+        row[0] = static_cast<int>(j + 1);
+        for (int i = 1; i <= m; i++) {
+            int up = row[i];
+            int cost = pattern[i - 1] == text[j] ? 0 : 1;
+            row[i] = std::min({row[i] + 1, row[i - 1] + 1, diag + cost});
+            diag = up;
+        }
+    }
+    return row[m];
+}
+
+int editDistance(const std::string& a, const std::string& b) {
+    return a.size() <= b.size() ? EditDistancePattern(a).distance(b)
+                                : EditDistancePattern(b).distance(a);
+}
+
+namespace {
+
+// Entries merged into the sorted array at once; below this a probe scans them directly
+const size_t kMaxRecentEntries = 4096;
+
+// FNV-1a over the part text, seeded with the key length and part number
+uint32_t segmentHash(size_t keyLength, int part, const char* data, size_t size) {
+    uint32_t hash = 2166136261u ^ static_cast<uint32_t>(keyLength * 31 + part);
+    hash *= 16777619u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Part boundaries of a key of the given length; short keys get empty parts
+size_t segmentStart(size_t keyLength, int part) {
+    return keyLength * part / FuzzyKeySet::kSegments;
+}
+
+} // namespace
+
+void FuzzyKeySet::clear() {
+    *this = FuzzyKeySet();
+}
+
+uint32_t FuzzyKeySet::append(const std::string& key, int count) {
+    if (offsets.empty()) offsets.push_back(0);
+    uint32_t index = static_cast<uint32_t>(keyCount());
+    text += key;
+    offsets.push_back(static_cast<uint32_t>(text.size()));
+    counts.push_back(count);
+    if (count > 0) liveKeys++;
+    return index;
+}
+
+void FuzzyKeySet::sortNew(size_t firstNew) {
+    std::sort(entries.begin() + firstNew, entries.end());
+    std::inplace_merge(entries.begin(), entries.begin() + firstNew, entries.end());
+}
+
+void FuzzyKeySet::addNew(const std::vector<std::pair<std::string, int>>& keys) {
+    size_t firstNew = entries.size();
+    for (const auto& key : keys) {
+        uint32_t index = append(key.first, key.second);
+        for (int part = 0; part < kSegments; part++) {
+            size_t start = segmentStart(key.first.size(), part);
+            size_t end = segmentStart(key.first.size(), part + 1);
+            entries.push_back({segmentHash(key.first.size(), part, key.first.data() + start, end - start), index});
+        }
+    }
+    sortNew(firstNew);
+}
+
+void FuzzyKeySet::lookup(uint32_t segment, std::vector<uint32_t>& keys) const {
+    auto range = std::equal_range(entries.begin(), entries.end(), Entry{segment, 0},
+                                  [](const Entry& a, const Entry& b) { return a.segment < b.segment; });
+    for (auto it = range.first; it != range.second; ++it) keys.push_back(it->key);
+    for (const Entry& entry : recent) {
+        if (entry.segment == segment) keys.push_back(entry.key);
+    }
+}
+
+// Index of the key, hidden or not, or -1; its first part is always in the index
+int FuzzyKeySet::locate(const std::string& key) const {
+    size_t end = segmentStart(key.size(), 1);
+    std::vector<uint32_t> candidates;
+    lookup(segmentHash(key.size(), 0, key.data(), end), candidates);
+    for (uint32_t candidate : candidates) {
+        if (keySize(candidate) == key.size() && memcmp(keyData(candidate), key.data(), key.size()) == 0) {
+            return static_cast<int>(candidate);
+        }
+    }
+    return -1;
+}
+
+void FuzzyKeySet::add(const std::string& key, int count) {
+    int index = locate(key);
+    if (index >= 0) {
+        if (counts[index] == 0) liveKeys++;
+        counts[index] += count;
+        return;
+    }
+
+    uint32_t added = append(key, count);
+    for (int part = 0; part < kSegments; part++) {
+        size_t start = segmentStart(key.size(), part);
+        size_t end = segmentStart(key.size(), part + 1);
+        recent.push_back({segmentHash(key.size(), part, key.data() + start, end - start), added});
+    }
+    if (recent.size() > kMaxRecentEntries) {
+        size_t firstNew = entries.size();
+        entries.insert(entries.end(), recent.begin(), recent.end());
+        recent.clear();
+        sortNew(firstNew);
+    }
+}
+
+void FuzzyKeySet::remove(const std::string& key) {
+    int index = locate(key);
+    if (index < 0 || counts[index] == 0) return;
+    if (--counts[index] > 0) return;
+    liveKeys--;
+    if (liveKeys * 2 < keyCount()) compact();
+}
+
+void FuzzyKeySet::compact() {
+    std::vector<std::pair<std::string, int>> live;
+    live.reserve(liveKeys);
+    for (uint32_t key = 0; key < keyCount(); key++) {
+        if (counts[key] > 0) live.push_back({std::string(keyData(key), keySize(key)), counts[key]});
+    }
+    clear();
+    addNew(live);
+}
+
+std::vector<FuzzyKeySet::Match> FuzzyKeySet::find(const std::string& query, int maxDistance) const {
+    std::vector<Match> matches;
+    if (maxDistance < 0 || keyCount() == 0) return matches;
+    EditDistancePattern pattern(query);
+    const size_t k = static_cast<size_t>(maxDistance);
+    const size_t shortest = query.size() > k ? query.size() - k : 0;
+    const size_t longest = query.size() + k;
+
+    std::vector<uint32_t> candidates;
+    if (maxDistance < kSegments) {
+        for (size_t length = shortest; length <= longest; length++) {
+            for (int part = 0; part < kSegments; part++) {
+                size_t start = segmentStart(length, part);
+                size_t size = segmentStart(length, part + 1) - start;
+                // The unchanged part sits within k bytes of where it starts in the key
+                size_t from = start > k ? start - k : 0;
+                for (size_t at = from; at <= start + k && at + size <= query.size(); at++) {
+                    lookup(segmentHash(length, part, query.data() + at, size), candidates);
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    } else {
+        for (uint32_t key = 0; key < keyCount(); key++) candidates.push_back(key);
+    }
+
+    for (uint32_t key : candidates) {
+        size_t size = keySize(key);
+        if (counts[key] == 0 || size < shortest || size > longest) continue;
+        int d = pattern.distance(keyData(key), size);
+        if (d <= maxDistance) matches.push_back({std::string(keyData(key), size), d});
+    }
+
+    std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+        return a.distance != b.distance ? a.distance < b.distance : a.value < b.value;
+    });
+    return matches;
+}
+
+size_t FuzzyKeySet::memoryBytes() const {
+    return text.capacity() + offsets.capacity() * sizeof(uint32_t) + counts.capacity() * sizeof(int) +
+           (entries.capacity() + recent.capacity()) * sizeof(Entry);
+}
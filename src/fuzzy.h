@@ -0,0 +1,80 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Levenshtein distance against a fixed pattern. Match masks are built once so a
+// pattern can be compared against many texts cheaply. Patterns up to 64 bytes use
+// Myers' bit-parallel algorithm (one pass of word operations per text byte);
+// longer ones fall back to a single-row dynamic program. Distances are in bytes.
+class EditDistancePattern {
+public:
+    explicit EditDistancePattern(const std::string& pattern);
+    int distance(const std::string& text) const { return distance(text.data(), text.size()); }
+    int distance(const char* text, size_t size) const;
+
+private:
+    std::string pattern;
+    std::vector<uint64_t> peq;
+};
+
+int editDistance(const std::string& a, const std::string& b);
+
+// Reference-counted key set answering "every key within edit distance k".
+//
+// Each key is cut into kSegments equal parts, indexed by (key length, part number,
+// part text). k edits can touch at most k parts, so for k < kSegments a key within
+// k edits of the query has one part that appears unchanged in the query, shifted by
+// at most k bytes; probing those few substrings yields a short candidate list that is
+// verified with EditDistancePattern. Larger k scan the keys of nearby lengths.
+//
+// Keys live in one byte arena and the part index in a sorted array, about 30 bytes
+// per key plus its text. A key whose count drops to zero is hidden until removed
+// keys are the majority, then the set is rebuilt.
+class FuzzyKeySet {
+public:
+    struct Match {
+        std::string value;
+        int distance;
+    };
+
+    static const int kSegments = 3;
+
+    void clear();
+    // Loads keys known to be absent and distinct, e.g. one batch of a GROUP BY
+    void addNew(const std::vector<std::pair<std::string, int>>& keys);
+    void add(const std::string& key, int count = 1);
+    void remove(const std::string& key);
+    std::vector<Match> find(const std::string& query, int maxDistance) const;
+    size_t size() const { return liveKeys; }
+    size_t memoryBytes() const;
+
+private:
+    struct Entry {
+        uint32_t segment;       // Hash of length, part number and part text
+        uint32_t key;
+        bool operator<(const Entry& other) const {
+            return segment != other.segment ? segment < other.segment : key < other.key;
+        }
+    };
+
+    std::string text;               // Key bytes back to back
+    std::vector<uint32_t> offsets;  // Start of each key in text, plus the end
+    std::vector<int> counts;
+    std::vector<Entry> entries;     // Sorted by segment
+    std::vector<Entry> recent;      // Unsorted; merged into entries once it grows
+    size_t liveKeys = 0;
+
+    size_t keyCount() const { return counts.size(); }
+    size_t keySize(uint32_t key) const { return offsets[key + 1] - offsets[key]; }
+    const char* keyData(uint32_t key) const { return text.data() + offsets[key]; }
+    uint32_t append(const std::string& key, int count);
+    void lookup(uint32_t segment, std::vector<uint32_t>& keys) const;
+    int locate(const std::string& key) const;
+    void sortNew(size_t firstNew);
+    void compact();
+};
+
+#endif // FUZZY_H
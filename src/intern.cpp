@@ -0,0 +1,90 @@
+#include "intern.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+// Entries are only freed once their count has dropped to zero, and only under
+// the pool mutex; intern() takes its reference under the same mutex, so a sweep
+// never frees an entry that is being handed out.
+const size_t kMinPurgeCount = 1024;
+
+} // namespace
+
+struct InternedStringPool {
+    std::mutex mutex;
+    std::unordered_map<std::string_view, std::unique_ptr<InternedString::Entry>> index;   // Keys view the entry's text
+    size_t bytes = 0;
+    size_t purgeAt = kMinPurgeCount;
+};
+
+namespace {
+
+InternedStringPool& pool() {
+    static InternedStringPool instance;
+    return instance;
+}
+
+size_t purgeLocked(InternedStringPool& p) {
+    size_t released = 0;
+    for (auto it = p.index.begin(); it != p.index.end();) {
+        if (it->second->refs.load(std::memory_order_acquire) == 0) {
+            released += it->second->text.size();
+            it = p.index.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    p.bytes -= released;
+    p.purgeAt = std::max(kMinPurgeCount, p.index.size() * 2);
+    return released;
+}
+
+} // namespace
+
+const std::string& InternedString::emptyString() {
+    static const std::string empty;
+    return empty;
+}
+
+InternedString::Entry* InternedString::intern(std::string_view text) {
+    if (text.empty()) return nullptr;
+
+    InternedStringPool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    auto it = p.index.find(text);
+    if (it != p.index.end()) {
+        it->second->refs.fetch_add(1, std::memory_order_relaxed);
+        return it->second.get();
+    }
+
+    if (p.index.size() >= p.purgeAt) purgeLocked(p);
+
+    auto stored = std::make_unique<Entry>();
+    stored->text.assign(text);
+    stored->refs.store(1, std::memory_order_relaxed);
+    Entry* result = stored.get();
+    p.bytes += result->text.size();
+    p.index.emplace(std::string_view(result->text), std::move(stored));
+    return result;
+}
+
+size_t InternedString::poolCount() {
+    InternedStringPool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    return p.index.size();
+}
+
+size_t InternedString::poolBytes() {
+    InternedStringPool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    return p.bytes;
+}
+
+size_t InternedString::purgePool() {
+    InternedStringPool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    return purgeLocked(p);
+}
@@ -0,0 +1,79 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Handle to a string stored once in a process-wide pool. Used for highly repeated
+// values (authors, publishers): copies are pointer-sized, equality is a pointer
+// compare, and every Book naming the same publisher shares one allocation.
+// Pooled strings are reference counted; ones no handle refers to any more are
+// freed by purgePool(), which intern() also runs once the pool has doubled.
+class InternedString {
+public:
+    InternedString() : entry(nullptr) {}
+    InternedString(const std::string& text) : entry(intern(text)) {}
+    InternedString(const char* text) : entry(intern(text ? std::string_view(text) : std::string_view())) {}
+    InternedString(std::string_view text) : entry(intern(text)) {}
+    InternedString(const InternedString& other) : entry(other.entry) { retain(); }
+    InternedString(InternedString&& other) noexcept : entry(other.entry) { other.entry = nullptr; }
+    ~InternedString() { release(); }
+
+    InternedString& operator=(const InternedString& other) {
+        if (entry != other.entry) {
+            release();
+            entry = other.entry;
+            retain();
+        }
+        return *this;
+    }
+    InternedString& operator=(InternedString&& other) noexcept {
+        if (this != &other) {
+            release();
+            entry = other.entry;
+            other.entry = nullptr;
+        }
+        return *this;
+    }
+
+    const std::string& str() const { return entry ? entry->text : emptyString(); }
+    operator const std::string&() const { return str(); }
+    const char* c_str() const { return str().c_str(); }
+    size_t size() const { return str().size(); }
+    bool empty() const { return entry == nullptr; }
+
+    bool operator==(const InternedString& other) const { return entry == other.entry; }
+    bool operator!=(const InternedString& other) const { return entry != other.entry; }
+
+    // Number of distinct strings and their total bytes held by the pool
+    static size_t poolCount();
+    static size_t poolBytes();
+
+    // Frees pooled strings no handle refers to; returns the bytes released
+    static size_t purgePool();
+
+private:
+    friend struct InternedStringPool;
+
+    struct Entry {
+        std::string text;
+        std::atomic<int> refs{0};
+    };
+
+    Entry* entry;
+
+    void retain() { if (entry) entry->refs.fetch_add(1, std::memory_order_relaxed); }
+    void release() { if (entry) entry->refs.fetch_sub(1, std::memory_order_acq_rel); }
+
+    static const std::string& emptyString();
+    static Entry* intern(std::string_view text);
+};
+
+inline bool operator==(const InternedString& a, const std::string& b) { return a.str() == b; }
+inline bool operator==(const std::string& a, const InternedString& b) { return a == b.str(); }
+inline bool operator!=(const InternedString& a, const std::string& b) { return a.str() != b; }
+inline bool operator!=(const std::string& a, const InternedString& b) { return a != b.str(); }
+
+#endif // INTERN_H
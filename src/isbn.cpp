@@ -0,0 +1,68 @@
+#include "isbn.h"
+
+namespace {
+
+// ISBN-13 check digit over the first 12 digits: weights alternate 1 and 3
+int isbn13CheckDigit(const int* digits) {
+    int sum = 0;
+    for (int i = 0; i < 12; i++) sum += digits[i] * (i % 2 ? 3 : 1);
+    return (10 - sum % 10) % 10;
+}
+
+long long packDigits(const int* digits, int count) {
+    long long value = 0;
+    for (int i = 0; i < count; i++) value = value * 10 + digits[i];
+    return value;
+}
+
+} // namespace
+
+bool parseIsbn(const std::string& text, long long& isbn) {
+    int digits[13];
+    int count = 0;
+    bool tenthIsX = false;
+    for (char c : text) {
+        if (c == '-' || c == ' ') continue;
+        if (count >= 13) return false;
+        if (c >= '0' && c <= '9') {
+            digits[count++] = c - '0';
+        } else if ((c == 'X' || c == 'x') && count == 9) {
+            digits[count++] = 10;
+            tenthIsX = true;
+        } else {
+            return false;
+        }
+    }
+    if (tenthIsX && count != 10) return false;
+
+    if (count == 10) {
+        // ISBN-10: weights 10..1, sum divisible by 11
+        int sum = 0;
+        for (int i = 0; i < 10; i++) sum += digits[i] * (10 - i);
+        if (sum % 11 != 0) return false;
+
+        int converted[13] = {9, 7, 8};
+        for (int i = 0; i < 9; i++) converted[3 + i] = digits[i];
+        converted[12] = isbn13CheckDigit(converted);
+        isbn = packDigits(converted, 13);
+        return true;
+    }
+    if (count != 13) return false;
+
+    isbn = packDigits(digits, 13);
+    return isValidIsbn(isbn);
+}
+
+bool isValidIsbn(long long isbn) {
+    if (isbn < 9780000000000LL || isbn > 9799999999999LL) return false;
+    int digits[13];
+    for (int i = 12; i >= 0; i--) {
+        digits[i] = static_cast<int>(isbn % 10);
+        isbn /= 10;
+    }
+    return digits[12] == isbn13CheckDigit(digits);
+}
+
+std::string formatIsbn(long long isbn) {
+    return isbn > 0 ? std::to_string(isbn) : std::string();
+}
@@ -0,0 +1,17 @@
+#ifndef ISBN_H
+#define ISBN_H
+
+#include <string>
+
+// ISBNs are stored as the 13-digit ISBN-13 value in a 64-bit integer; 0 means none.
+// parseIsbn accepts ISBN-10 or ISBN-13 with optional hyphens/spaces ("0-306-40615-2",
+// "978-0-306-40615-7"), checks the check digit and converts ISBN-10 to ISBN-13.
+bool parseIsbn(const std::string& text, long long& isbn);
+
+// True for a 13-digit 978/979 value with a correct check digit
+bool isValidIsbn(long long isbn);
+
+// The 13 digits without hyphens, or "" for 0
+std::string formatIsbn(long long isbn);
+
+#endif // ISBN_H
@@ -0,0 +1,562 @@
+#include "jsonl.h"
+#include "isbn.h"
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Output is collected and written in blocks of about this size
+const size_t kWriteBlock = 1 << 20;
+
+// Input is read in chunks of this size and split into lines in memory
+const size_t kReadChunk = 1 << 20;
+
+// Records handed to upsertBooks at a time
+const size_t kImportBatch = 1000;
+
+const char kBase64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+class JsonWriter {
+public:
+    explicit JsonWriter(std::ofstream& out) : out(out) { buffer.reserve(kWriteBlock + 4096); }
+
+    void beginObject() {
+        buffer += '{';
+        first = true;
+    }
+
+    void endObject() {
+        buffer += "}\n";
+        if (buffer.size() >= kWriteBlock) flush();
+    }
+
+    void key(const char* name) {
+        if (!first) buffer += ',';
+        first = false;
+        buffer += '"';
+        buffer += name;
+        buffer += "\":";
+    }
+
+    void number(long long value) {
+        char digits[24];
+        char* last = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        buffer.append(digits, last - digits);
+    }
+
+    // UTF-8 is passed through; only quotes, backslashes and control characters are
+    // escaped. Runs of plain bytes are appended in one go.
+    void string(const std::string& text) {
+        static const char hex[] = "0123456789abcdef";
+        buffer += '"';
+        const char* s = text.data();
+        size_t run = 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+            buffer.append(s + run, i - run);
+            run = i + 1;
+            switch (c) {
+            case '"': buffer += "\\\""; break;
+            case '\\': buffer += "\\\\"; break;
+            case '\n': buffer += "\\n"; break;
+            case '\r': buffer += "\\r"; break;
+            case '\t': buffer += "\\t"; break;
+            default:
+                buffer += "\\u00";
+                buffer += hex[c >> 4];
+                buffer += hex[c & 0xF];
+            }
+        }
+        buffer.append(s + run, text.size() - run);
+        buffer += '"';
+    }
+
+    void base64(const std::vector<unsigned char>& data) {
+        buffer += '"';
+        size_t start = buffer.size();
+        buffer.resize(start + (data.size() + 2) / 3 * 4);
+        char* out = &buffer[start];
+        size_t i = 0;
+        for (; i + 3 <= data.size(); i += 3) {
+            unsigned int v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+            *out++ = kBase64[v >> 18];
+            *out++ = kBase64[(v >> 12) & 0x3F];
+            *out++ = kBase64[(v >> 6) & 0x3F];
+            *out++ = kBase64[v & 0x3F];
+        }
+        if (i < data.size()) {
+            unsigned int v = data[i] << 16;
+            if (i + 1 < data.size()) v |= data[i + 1] << 8;
+            *out++ = kBase64[v >> 18];
+            *out++ = kBase64[(v >> 12) & 0x3F];
+            *out++ = i + 1 < data.size() ? kBase64[(v >> 6) & 0x3F] : '=';
+            *out++ = '=';
+        }
+        buffer += '"';
+    }
+
+    bool flush() {
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        written += buffer.size();
+        buffer.clear();
+        return static_cast<bool>(out);
+    }
+
+    long long bytes() const { return written; }
+
+private:
+    std::ofstream& out;
+    std::string buffer;
+    long long written = 0;
+    bool first = true;
+};
+
+// Splits a stream into lines, reading large chunks rather than a line at a time
+class LineReader {
+public:
+    explicit LineReader(std::ifstream& in) : in(in) {}
+
+    bool next(std::string& line) {
+        line.clear();
+        for (;;) {
+            const char* begin = buffer.data() + pos;
+            const char* end = static_cast<const char*>(memchr(begin, '\n', buffer.size() - pos));
+            if (end) {
+                line.append(begin, end - begin);
+                pos = end - buffer.data() + 1;
+                break;
+            }
+            line.append(begin, buffer.size() - pos);
+            if (!fill()) {
+                if (line.empty()) return false;
+                break;
+            }
+        }
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        return true;
+    }
+
+    long long bytes() const { return consumed; }
+
+private:
+    std::ifstream& in;
+    std::string buffer;
+    size_t pos = 0;
+    long long consumed = 0;
+
+    bool fill() {
+        buffer.resize(kReadChunk);
+        in.read(&buffer[0], static_cast<std::streamsize>(kReadChunk));
+        buffer.resize(static_cast<size_t>(in.gcount()));
+        consumed += buffer.size();
+        pos = 0;
+        return !buffer.empty();
+    }
+};
+
+void appendUtf8(std::string& out, unsigned int cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+bool decodeBase64(const std::string& text, std::vector<unsigned char>& data) {
+    static signed char table[256];
+    static bool ready = false;
+    if (!ready) {
+        memset(table, -1, sizeof(table));
+        for (int i = 0; i < 64; i++) table[static_cast<unsigned char>(kBase64[i])] = static_cast<signed char>(i);
+        ready = true;
+    }
+
+    size_t length = text.size();
+    while (length > 0 && text[length - 1] == '=') length--;
+    if (text.size() % 4 != 0 || text.size() - length > 2) return false;
+
+    data.clear();
+    data.reserve(length * 3 / 4);
+    unsigned int v = 0;
+    int bits = 0;
+    for (size_t i = 0; i < length; i++) {
+        int d = table[static_cast<unsigned char>(text[i])];
+        if (d < 0) return false;
+        v = (v << 6) | d;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            data.push_back(static_cast<unsigned char>(v >> bits));
+        }
+    }
+    return true;
+}
+
+// Parser for one flat JSON object per line. Values of unknown keys, nested ones
+// included, are skipped.
+class RecordParser {
+public:
+    RecordParser(const std::string& line) : p(line.data()), end(line.data() + line.size()) {}
+
+    bool parse(Book& book, std::string& photoFile, std::string& error) {
+        book = Book();
+        photoFile.clear();
+        std::string key, text;
+
+        skipSpace();
+        if (!consume('{')) return fail(error, "expected '{'");
+        skipSpace();
+        if (consume('}')) return finish(error);
+        for (;;) {
+            skipSpace();
+            if (!readString(key)) return fail(error, "expected a key");
+            skipSpace();
+            if (!consume(':')) return fail(error, "expected ':'");
+            skipSpace();
+
+            bool ok = true;
+            if (key == "author" || key == "title" || key == "publisher") {
+                ok = readOptionalString(text);
+                if (key == "author") book.author = text;
+                else if (key == "title") book.title = text;
+                else book.publisher = text;
+            } else if (key == "year" || key == "pages") {
+                long long value = 0;
+                ok = readOptionalNumber(value);
+                (key == "year" ? book.year : book.pages) = static_cast<int>(value);
+            } else if (key == "isbn") {
+                long long value = 0;
+                if (peek() == '"') {
+                    ok = readString(text) && (text.empty() || parseIsbn(text, value));
+                } else {
+                    ok = readOptionalNumber(value) && (value == 0 || isValidIsbn(value));
+                }
+                if (!ok) return fail(error, "invalid ISBN");
+                book.isbn = value;
+            } else if (key == "photo") {
+                ok = readOptionalString(text) && decodeBase64(text, book.photo);
+                if (!ok) return fail(error, "invalid base64 photo");
+            } else if (key == "photoFile") {
+                ok = readOptionalString(photoFile);
+            } else {
+                ok = skipValue();
+            }
+            if (!ok) return fail(error, "bad value for \"" + key + "\"");
+
+            skipSpace();
+            if (consume(',')) continue;
+            if (consume('}')) break;
+            return fail(error, "expected ',' or '}'");
+        }
+        skipSpace();
+        if (p != end) return fail(error, "trailing characters");
+        return finish(error, &book);
+    }
+
+private:
+    const char* p;
+    const char* end;
+
+    static bool fail(std::string& error, const std::string& message) {
+        error = message;
+        return false;
+    }
+
+    static bool finish(std::string& error, const Book* book = nullptr) {
+        if (!book || book->author.empty() || book->title.empty()) return fail(error, "author and title are required");
+        return true;
+    }
+
+    char peek() const { return p < end ? *p : '\0'; }
+
+    bool consume(char c) {
+        if (p < end && *p == c) {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    void skipSpace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    }
+
+    bool readLiteral(const char* word) {
+        size_t length = strlen(word);
+        if (static_cast<size_t>(end - p) < length || memcmp(p, word, length) != 0) return false;
+        p += length;
+        return true;
+    }
+
+    bool readHex4(unsigned int& value) {
+        if (end - p < 4) return false;
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = *p++;
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    bool readString(std::string& out) {
+        out.clear();
+        if (!consume('"')) return false;
+        for (;;) {
+            // Copy up to the next quote or escape in one step
+            const char* run = p;
+            while (p < end && *p != '"' && *p != '\\') p++;
+            out.append(run, p - run);
+            if (p >= end) return false;
+            if (*p++ == '"') return true;
+
+            if (p >= end) return false;
+            char c = *p++;
+            switch (c) {
+            case '"': case '\\': case '/': out += c; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                unsigned int cp;
+                if (!readHex4(cp)) return false;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    unsigned int low;
+                    if (!readLiteral("\\u") || !readHex4(low) || low < 0xDC00 || low > 0xDFFF) return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    return false;
+                }
+                appendUtf8(out, cp);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+    }
+
+    bool readOptionalString(std::string& out) {
+        out.clear();
+        return readLiteral("null") || readString(out);
+    }
+
+    bool readOptionalNumber(long long& value) {
+        value = 0;
+        if (readLiteral("null")) return true;
+        bool negative = consume('-');
+        if (p >= end || *p < '0' || *p > '9') return false;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (value > 99999999999999999LL) return false;
+            value = value * 10 + (*p++ - '0');
+        }
+        if (negative) value = -value;
+        return p >= end || (*p != '.' && *p != 'e' && *p != 'E');
+    }
+
+    bool skipValue() {
+        std::string ignored;
+        char c = peek();
+        if (c == '"') return readString(ignored);
+        if (c == '{' || c == '[') {
+            int depth = 0;
+            while (p < end) {
+                c = *p;
+                if (c == '"') {
+                    if (!readString(ignored)) return false;
+                    continue;
+                }
+                p++;
+                if (c == '{' || c == '[') depth++;
+                else if ((c == '}' || c == ']') && --depth == 0) return true;
+            }
+            return false;
+        }
+        if (readLiteral("true") || readLiteral("false") || readLiteral("null")) return true;
+
+        // Numbers, fractions and exponents included
+        const char* start = p;
+        while (p < end && (strchr("+-.eE", *p) || (*p >= '0' && *p <= '9'))) p++;
+        return p != start;
+    }
+};
+
+const char* photoExtension(const std::vector<unsigned char>& photo) {
+    if (photo.size() >= 3 && photo[0] == 0xFF && photo[1] == 0xD8) return ".jpg";
+    if (photo.size() >= 4 && photo[0] == 0x89 && photo[1] == 'P' && photo[2] == 'N' && photo[3] == 'G') return ".png";
+    if (photo.size() >= 4 && memcmp(photo.data(), "GIF8", 4) == 0) return ".gif";
+    if (photo.size() >= 2 && photo[0] == 'B' && photo[1] == 'M') return ".bmp";
+    return ".bin";
+}
+
+bool writeFile(const fs::path& path, const std::vector<unsigned char>& data) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(file);
+}
+
+bool readFile(const fs::path& path, std::vector<unsigned char>& data) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) return false;
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    data.resize(static_cast<size_t>(size));
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), size));
+}
+
+} // namespace
+
+bool exportJsonl(Database& db, const std::string& path, const JsonlExportOptions& options,
+                 JsonlResult& result) {
+    result = JsonlResult();
+    fs::path target = fs::u8path(path);
+    std::ofstream out(target, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        result.error = "Cannot create " + path;
+        return false;
+    }
+
+    fs::path photoDir = target.parent_path() / fs::u8path(options.photoDir);
+    if (options.photos == JsonlExportOptions::PhotoFiles) {
+        std::error_code ec;
+        fs::create_directories(photoDir, ec);
+        if (ec) {
+            result.error = "Cannot create " + photoDir.u8string() + ": " + ec.message();
+            return false;
+        }
+    }
+
+    JsonWriter writer(out);
+    bool includePhoto = options.photos != JsonlExportOptions::PhotoNone;
+    bool success = db.forEachBook(options.filter, includePhoto, [&](const Book& book) {
+        writer.beginObject();
+        writer.key("id");
+        writer.number(book.id);
+        writer.key("author");
+        writer.string(book.author);
+        writer.key("title");
+        writer.string(book.title);
+        writer.key("year");
+        writer.number(book.year);
+        writer.key("pages");
+        writer.number(book.pages);
+        if (!book.publisher.empty()) {
+            writer.key("publisher");
+            writer.string(book.publisher);
+        }
+        if (book.isbn != 0) {
+            writer.key("isbn");
+            writer.string(formatIsbn(book.isbn));
+        }
+        if (!book.photo.empty() && options.photos == JsonlExportOptions::PhotoInline) {
+            writer.key("photo");
+            writer.base64(book.photo);
+        } else if (!book.photo.empty() && options.photos == JsonlExportOptions::PhotoFiles) {
+            std::string name = std::to_string(book.id) + photoExtension(book.photo);
+            if (!writeFile(photoDir / name, book.photo)) {
+                result.error = "Cannot write photo " + (photoDir / name).u8string();
+                return false;
+            }
+            writer.key("photoFile");
+            writer.string((fs::u8path(options.photoDir) / name).generic_u8string());
+        }
+        writer.endObject();
+        result.books++;
+        return true;
+    });
+
+    if (success && !writer.flush()) {
+        result.error = "Write to " + path + " failed";
+        success = false;
+    }
+    if (!success && result.error.empty()) result.error = db.getLastError();
+    result.bytes = writer.bytes();
+    return success;
+}
+
+bool importJsonl(Database& db, const std::string& path, JsonlResult& result) {
+    result = JsonlResult();
+    fs::path source = fs::u8path(path);
+    std::ifstream in(source, std::ios::binary);
+    if (!in.is_open()) {
+        result.error = "Cannot open " + path;
+        return false;
+    }
+
+    std::vector<Book> batch;
+    batch.reserve(kImportBatch);
+    long long batchStart = 1;
+    auto flush = [&](long long lineNumber) {
+        UpsertResult upserted;
+        if (!db.upsertBooks(batch, upserted)) {
+            result.error = "Lines " + std::to_string(batchStart) + "-" + std::to_string(lineNumber) + ": " +
+                           db.getLastError();
+            return false;
+        }
+        result.upserted.inserted += upserted.inserted;
+        result.upserted.updated += upserted.updated;
+        result.upserted.unchanged += upserted.unchanged;
+        result.books += static_cast<long long>(batch.size());
+        batch.clear();
+        batchStart = lineNumber + 1;
+        return true;
+    };
+
+    LineReader reader(in);
+    std::string line, photoFile, error;
+    long long lineNumber = 0;
+    bool success = true, badLine = false;
+    while (success && reader.next(line)) {
+        lineNumber++;
+        if (line.find_first_not_of(" \t") == std::string::npos) continue;
+
+        Book book;
+        if (!RecordParser(line).parse(book, photoFile, error)) {
+            result.error = "Line " + std::to_string(lineNumber) + ": " + error;
+            badLine = true;
+            break;
+        }
+        if (!photoFile.empty() && book.photo.empty()) {
+            fs::path photoPath = fs::u8path(photoFile);
+            if (photoPath.is_relative()) photoPath = source.parent_path() / photoPath;
+            if (!readFile(photoPath, book.photo)) {
+                result.error = "Line " + std::to_string(lineNumber) + ": cannot read " + photoPath.u8string();
+                badLine = true;
+                break;
+            }
+        }
+        batch.push_back(std::move(book));
+        if (batch.size() >= kImportBatch) success = flush(lineNumber);
+    }
+    // The records read before a bad line are merged too; the bad line's error is kept
+    // unless that merge fails first
+    if (success && !batch.empty()) success = flush(badLine ? lineNumber - 1 : lineNumber);
+    success = success && !badLine;
+    if (success && in.bad()) {
+        result.error = "Read from " + path + " failed";
+        success = false;
+    }
+    result.bytes = reader.bytes();
+    return success;
+}
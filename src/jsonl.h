@@ -0,0 +1,37 @@
+#ifndef JSONL_H
+#define JSONL_H
+
+#include <string>
+#include "database.h"
+
+// Catalogue exchange as JSON Lines, one book per line:
+//   {"id":1,"author":"...","title":"...","year":1884,"pages":600,"publisher":"...",
+//    "isbn":"9780306406157","photo":"<base64>"}
+// publisher, isbn and the photo keys are left out when empty. With PhotoFiles the
+// photo is written next to the export and referenced as "photoFile" instead.
+struct JsonlExportOptions {
+    enum PhotoMode { PhotoNone, PhotoInline, PhotoFiles };
+    PhotoMode photos = PhotoNone;
+    std::string photoDir = "photos";    // PhotoFiles: relative to the export file
+    BookFilter filter;
+};
+
+struct JsonlResult {
+    long long books = 0;        // Export: rows written; import: records merged
+    long long bytes = 0;
+    UpsertResult upserted;      // Import only
+    std::string error;          // Set when false is returned; import errors name the line
+};
+
+// Streams the matching books from the database to path; memory use does not grow
+// with the catalogue.
+bool exportJsonl(Database& db, const std::string& path, const JsonlExportOptions& options,
+                 JsonlResult& result);
+
+// Reads records written by exportJsonl (or any flat JSON object per line with the
+// same keys) and merges them with upsertBooks in batches; unknown keys are ignored
+// and "id" is not used. Relative photoFile paths are resolved against the file's
+// directory. Records before a failing line stay imported.
+bool importJsonl(Database& db, const std::string& path, JsonlResult& result);
+
+#endif // JSONL_H
@@ -14,7 +14,13 @@
 #include <vector>
 #include <sstream>
 #include <fstream>
+#include <memory>
+#include <thread>
 #include "database.h"
+#include "booklist.h"
+#include "jsonl.h"
+#include "maintenance.h"
+#include "sqlitemem.h"
 #include "resource.h"
 
 #pragma comment(lib, "comctl32.lib")
@@ -26,9 +32,26 @@ Database g_db;
 HWND g_hMainWnd;
 HWND g_hListView;
 HWND g_hStatusBar;
-std::vector<Book> g_currentBooks;
+BookListModel g_bookList(g_db);     // Rows of the virtual ListView
+std::string g_snapshotPath;         // List snapshot next to the database
+std::string g_dbPath;
+MaintenanceScheduler g_maintenance(g_db);
 int g_selectedBookId = -1;
 
+// Posted after the first paint to bring a list loaded from the snapshot up to date.
+// The journal is read on a worker thread with its own connection, which posts
+// WM_APP_RECONCILED when the update is ready to install.
+#define WM_APP_RECONCILE    (WM_APP + 1)
+#define WM_APP_RECONCILED   (WM_APP + 2)
+std::thread g_reconcileThread;
+std::unique_ptr<BookListModel::Update> g_reconcileUpdate;
+bool g_reconcileAgain = false;      // Books changed while the worker was reading
+
+// Housekeeping timer; a slice only runs once there has been no input for a while
+#define IDT_MAINTENANCE     1
+#define MAINTENANCE_PERIOD  2000
+#define MAINTENANCE_IDLE    5000
+
 // Control IDs
 #define IDC_LISTVIEW        1001
 #define IDC_BTN_ADD         1002
@@ -57,7 +80,15 @@ INT_PTR CALLBACK AboutDlgProc(HWND, UINT, WPARAM, LPARAM);
 void CreateMainWindow(HWND hWnd);
 void CreateListView(HWND hWnd);
 void RefreshBookList();
+void ApplyBookChanges();
+void StartReconcile(HWND hWnd);
+void FinishReconcile();
+void ImportCatalogue(HWND hWnd);
+void ExportCatalogue(HWND hWnd);
+void BackupDatabase(HWND hWnd);
+void CompactDatabase(HWND hWnd);
 void UpdateStatusBar();
+void UpdateListView();
 std::wstring StringToWString(const std::string& str);
 std::string WStringToString(const std::wstring& wstr);
 
@@ -75,6 +106,15 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     icex.dwICC = ICC_LISTVIEW_CLASSES | ICC_BAR_CLASSES;
     InitCommonControlsEx(&icex);
     
+    // SQLite memory setup has to precede the first connection; if it is refused the
+    // defaults stay in place and the application still runs, only less frugally
+    std::string memoryError;
+    if (!configureSqliteMemory(SqliteMemoryConfig(), memoryError)) {
+        std::wstring message = L"SQLite memory configuration failed; using the defaults.\n\n" +
+                               StringToWString(memoryError);
+        MessageBoxW(nullptr, message.c_str(), L"Warning", MB_ICONWARNING);
+    }
+    
     // Register window class
     WNDCLASSEXW wcex = {0};
     wcex.cbSize = sizeof(WNDCLASSEXW);
@@ -108,13 +148,27 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     GetModuleFileNameA(nullptr, dbPath, MAX_PATH);
     std::string path(dbPath);
     path = path.substr(0, path.find_last_of("\\/")) + "\\library.db";
+    g_dbPath = path;
     
     if (!g_db.open(path)) {
-        MessageBoxW(g_hMainWnd, L"Failed to open database!", L"Error", MB_ICONERROR);
+        std::wstring message = L"Failed to open database!\n\n" + StringToWString(g_db.getLastError());
+        MessageBoxW(g_hMainWnd, message.c_str(), L"Error", MB_ICONERROR);
+    }
+    
+    // The snapshot shows the list without reading every book; changes made since it
+    // was written are applied once the window is on screen
+    g_snapshotPath = path.substr(0, path.find_last_of('.')) + ".snapshot";
+    bool fromSnapshot = g_bookList.loadSnapshot(g_snapshotPath);
+    if (fromSnapshot) {
+        UpdateListView();
+    } else {
+        RefreshBookList();
     }
     
     ShowWindow(g_hMainWnd, nCmdShow);
     UpdateWindow(g_hMainWnd);
+    if (fromSnapshot) PostMessage(g_hMainWnd, WM_APP_RECONCILE, 0, 0);
+    SetTimer(g_hMainWnd, IDT_MAINTENANCE, MAINTENANCE_PERIOD, nullptr);
     
     // Message loop
     MSG msg;
@@ -123,6 +177,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         DispatchMessage(&msg);
     }
     
+    g_bookList.saveSnapshot(g_snapshotPath);
     g_db.close();
     return (int)msg.wParam;
 }
@@ -148,7 +203,7 @@ void CreateListView(HWND hWnd) {
     GetClientRect(hWnd, &rc);
     
     g_hListView = CreateWindowExW(WS_EX_CLIENTEDGE, WC_LISTVIEWW, L"",
-        WS_CHILD | WS_VISIBLE | LVS_REPORT | LVS_SINGLESEL | LVS_SHOWSELALWAYS,
+        WS_CHILD | WS_VISIBLE | LVS_REPORT | LVS_SINGLESEL | LVS_SHOWSELALWAYS | LVS_OWNERDATA,
         10, 50, rc.right - 20, rc.bottom - 100, hWnd, (HMENU)IDC_LISTVIEW, g_hInst, nullptr);
     
     ListView_SetExtendedListViewStyle(g_hListView, LVS_EX_FULLROWSELECT | LVS_EX_GRIDLINES);
@@ -192,93 +247,211 @@ void CreateMainWindow(HWND hWnd) {
     g_hStatusBar = CreateWindowExW(0, STATUSCLASSNAMEW, nullptr,
         WS_CHILD | WS_VISIBLE | SBARS_SIZEGRIP,
         0, 0, 0, 0, hWnd, (HMENU)IDC_STATUSBAR, g_hInst, nullptr);
-    
-    RefreshBookList();
 }
 
 
+// The ListView is owner-data: it only knows the row count and asks for text via
+// LVN_GETDISPINFO, so loading a list no longer inserts or converts every row.
+void UpdateListView() {
+    ListView_SetItemCountEx(g_hListView, static_cast<int>(g_bookList.size()), 0);
+    InvalidateRect(g_hListView, nullptr, FALSE);
+    
+    if (g_bookList.showingAll()) {
+        UpdateStatusBar();
+    } else {
+        std::wstring status = L"Search results: " + std::to_wstring(g_bookList.size()) + L" books found";
+        SendMessageW(g_hStatusBar, SB_SETTEXTW, 0, (LPARAM)status.c_str());
+    }
+}
+
 void RefreshBookList() {
-    ListView_DeleteAllItems(g_hListView);
-    g_currentBooks = g_db.getAllBooks();
+    g_bookList.loadAll();
+    UpdateListView();
+}
+
+// Applies journal entries since the last load instead of reloading every row. While a
+// reconcile is in flight the list is left to it, and it runs once more afterwards.
+void ApplyBookChanges() {
+    if (g_reconcileThread.joinable()) {
+        g_reconcileAgain = true;
+        return;
+    }
+    g_bookList.applyChanges();
+    UpdateListView();
+}
+
+void StartReconcile(HWND hWnd) {
+    if (g_reconcileThread.joinable()) return;
+    g_reconcileAgain = false;
+    g_reconcileUpdate.reset(new BookListModel::Update(g_bookList.beginUpdate()));
+    BookListModel::Update* update = g_reconcileUpdate.get();
+    std::string path = g_dbPath;
+    g_reconcileThread = std::thread([hWnd, update, path]() {
+        Database reader;
+        if (reader.openReader(path)) BookListModel::computeUpdate(reader, *update);
+        reader.close();
+        PostMessage(hWnd, WM_APP_RECONCILED, 0, 0);
+    });
+}
+
+void FinishReconcile() {
+    if (!g_reconcileThread.joinable()) return;
+    g_reconcileThread.join();
+    std::unique_ptr<BookListModel::Update> update = std::move(g_reconcileUpdate);
+    if (!update->ok) {
+        // No second connection, or it failed part way; fall back to the UI thread
+        g_reconcileAgain = false;
+        ApplyBookChanges();
+        return;
+    }
+    if (g_bookList.installUpdate(*update)) UpdateListView();
+    if (g_reconcileAgain) StartReconcile(g_hMainWnd);
+}
+
+void ImportCatalogue(HWND hWnd) {
+    OPENFILENAMEW ofn = {0};
+    wchar_t szFile[MAX_PATH] = {0};
     
-    LVITEMW lvi = {0};
-    lvi.mask = LVIF_TEXT;
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hWnd;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrFilter = L"JSON Lines\0*.jsonl;*.json\0All Files\0*.*\0";
+    ofn.nFilterIndex = 1;
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
+    if (!GetOpenFileNameW(&ofn)) return;
     
-    for (size_t i = 0; i < g_currentBooks.size(); i++) {
-        const Book& book = g_currentBooks[i];
-        
-        lvi.iItem = static_cast<int>(i);
-        lvi.iSubItem = 0;
-        std::wstring id = std::to_wstring(book.id);
-        lvi.pszText = const_cast<LPWSTR>(id.c_str());
-        ListView_InsertItem(g_hListView, &lvi);
-        
-        std::wstring author = StringToWString(book.author);
-        ListView_SetItemText(g_hListView, i, 1, const_cast<LPWSTR>(author.c_str()));
-        
-        std::wstring title = StringToWString(book.title);
-        ListView_SetItemText(g_hListView, i, 2, const_cast<LPWSTR>(title.c_str()));
-        
-        std::wstring year = std::to_wstring(book.year);
-        ListView_SetItemText(g_hListView, i, 3, const_cast<LPWSTR>(year.c_str()));
-        
-        std::wstring pages = std::to_wstring(book.pages);
-        ListView_SetItemText(g_hListView, i, 4, const_cast<LPWSTR>(pages.c_str()));
-        
-        std::wstring publisher = StringToWString(book.publisher);
-        ListView_SetItemText(g_hListView, i, 5, const_cast<LPWSTR>(publisher.c_str()));
-    }
+    JsonlResult result;
+    bool success = importJsonl(g_db, WStringToString(szFile), result);
+    ApplyBookChanges();
     
-    UpdateStatusBar();
+    std::wstringstream message;
+    message << result.upserted.inserted << L" added, " << result.upserted.updated << L" updated, "
+            << result.upserted.unchanged << L" unchanged.";
+    if (!success) message << L"\n\nImport stopped: " << StringToWString(result.error);
+    MessageBoxW(hWnd, message.str().c_str(), L"Import", success ? MB_ICONINFORMATION : MB_ICONWARNING);
 }
 
-void UpdateStatusBar() {
-    std::wstring status = L"Total books: " + std::to_wstring(g_currentBooks.size());
-    SendMessageW(g_hStatusBar, SB_SETTEXTW, 0, (LPARAM)status.c_str());
+void ExportCatalogue(HWND hWnd) {
+    OPENFILENAMEW ofn = {0};
+    wchar_t szFile[MAX_PATH] = L"library.jsonl";
+    
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hWnd;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrFilter = L"JSON Lines\0*.jsonl\0All Files\0*.*\0";
+    ofn.nFilterIndex = 1;
+    ofn.lpstrDefExt = L"jsonl";
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+    if (!GetSaveFileNameW(&ofn)) return;
+    
+    // Photos go into the file so it can be moved on its own
+    JsonlExportOptions options;
+    options.photos = JsonlExportOptions::PhotoInline;
+    JsonlResult result;
+    if (exportJsonl(g_db, WStringToString(szFile), options, result)) {
+        std::wstring message = std::to_wstring(result.books) + L" books exported.";
+        MessageBoxW(hWnd, message.c_str(), L"Export", MB_ICONINFORMATION);
+    } else {
+        MessageBoxW(hWnd, StringToWString(result.error).c_str(), L"Export", MB_ICONERROR);
+    }
 }
 
-void DisplaySearchResults(const std::vector<Book>& books) {
-    ListView_DeleteAllItems(g_hListView);
-    g_currentBooks = books;
+// Online backup: messages are pumped between page batches so the window stays
+// usable and books can still be edited while the copy runs
+void BackupDatabase(HWND hWnd) {
+    static bool running = false;
+    if (running) return;
     
-    LVITEMW lvi = {0};
-    lvi.mask = LVIF_TEXT;
+    OPENFILENAMEW ofn = {0};
+    wchar_t szFile[MAX_PATH] = L"library-backup.db";
     
-    for (size_t i = 0; i < g_currentBooks.size(); i++) {
-        const Book& book = g_currentBooks[i];
-        
-        lvi.iItem = static_cast<int>(i);
-        lvi.iSubItem = 0;
-        std::wstring id = std::to_wstring(book.id);
-        lvi.pszText = const_cast<LPWSTR>(id.c_str());
-        ListView_InsertItem(g_hListView, &lvi);
-        
-        std::wstring author = StringToWString(book.author);
-        ListView_SetItemText(g_hListView, i, 1, const_cast<LPWSTR>(author.c_str()));
-        
-        std::wstring title = StringToWString(book.title);
-        ListView_SetItemText(g_hListView, i, 2, const_cast<LPWSTR>(title.c_str()));
-        
-        std::wstring year = std::to_wstring(book.year);
-        ListView_SetItemText(g_hListView, i, 3, const_cast<LPWSTR>(year.c_str()));
-        
-        std::wstring pages = std::to_wstring(book.pages);
-        ListView_SetItemText(g_hListView, i, 4, const_cast<LPWSTR>(pages.c_str()));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hWnd;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrFilter = L"SQLite Database\0*.db\0All Files\0*.*\0";
+    ofn.nFilterIndex = 1;
+    ofn.lpstrDefExt = L"db";
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+    if (!GetSaveFileNameW(&ofn)) return;
+    
+    running = true;
+    bool quit = false;
+    bool success = g_db.backupTo(WStringToString(szFile), [&](const BackupProgress& progress) {
+        int percent = progress.totalPages > 0
+            ? (progress.totalPages - progress.remainingPages) * 100 / progress.totalPages : 100;
+        std::wstring status = L"Backing up... " + std::to_wstring(percent) + L"%";
+        SendMessageW(g_hStatusBar, SB_SETTEXTW, 0, (LPARAM)status.c_str());
         
-        std::wstring publisher = StringToWString(book.publisher);
-        ListView_SetItemText(g_hListView, i, 5, const_cast<LPWSTR>(publisher.c_str()));
+        MSG msg;
+        while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) {
+                quit = true;
+                PostQuitMessage(static_cast<int>(msg.wParam));
+                return false;
+            }
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
+        }
+        return true;
+    });
+    running = false;
+    if (quit) return;
+    
+    UpdateListView();
+    if (!success) {
+        MessageBoxW(hWnd, StringToWString(g_db.getLastError()).c_str(), L"Backup failed", MB_ICONERROR);
+    }
+}
+
+// Files created before incremental auto_vacuum never shrink; converting one rewrites
+// it once, after which idle maintenance returns deleted space to the disk
+void CompactDatabase(HWND hWnd) {
+    FreeSpaceStats space;
+    if (!g_db.getFreeSpaceStats(space)) {
+        MessageBoxW(hWnd, StringToWString(g_db.getLastError()).c_str(), L"Compact failed", MB_ICONERROR);
+        return;
+    }
+    std::wstring freeMb = std::to_wstring(space.freeBytes() / (1024 * 1024));
+    if (space.autoVacuum == FreeSpaceStats::Incremental) {
+        std::wstring message = L"Free space is already returned to the disk while the application is idle.\n\n" +
+                               freeMb + L" MB is waiting to be reclaimed.";
+        MessageBoxW(hWnd, message.c_str(), L"Compact Database", MB_ICONINFORMATION);
+        return;
     }
     
-    std::wstring status = L"Search results: " + std::to_wstring(g_currentBooks.size()) + L" books found";
+    std::wstring fileMb = std::to_wstring(space.pageCount * space.pageSize / (1024 * 1024));
+    std::wstring message = L"The database file (" + fileMb + L" MB, " + freeMb + L" MB unused) is rewritten once "
+                           L"so that space freed later is returned while the application is idle. "
+                           L"This can take a while on a large catalogue.\n\nContinue?";
+    if (MessageBoxW(hWnd, message.c_str(), L"Compact Database", MB_YESNO | MB_ICONQUESTION) != IDYES) return;
+    
+    SendMessageW(g_hStatusBar, SB_SETTEXTW, 0, (LPARAM)L"Compacting...");
+    HCURSOR cursor = SetCursor(LoadCursor(nullptr, IDC_WAIT));
+    bool success = g_db.enableIncrementalVacuum();
+    SetCursor(cursor);
+    UpdateStatusBar();
+    if (!success) {
+        MessageBoxW(hWnd, StringToWString(g_db.getLastError()).c_str(), L"Compact failed", MB_ICONERROR);
+    }
+}
+
+void UpdateStatusBar() {
+    std::wstring status = L"Total books: " + std::to_wstring(g_bookList.size());
     SendMessageW(g_hStatusBar, SB_SETTEXTW, 0, (LPARAM)status.c_str());
 }
 
+void DisplaySearchResults(const BookFilter& filter) {
+    g_bookList.loadFilter(filter);
+    ListView_SetItemState(g_hListView, -1, 0, LVIS_SELECTED | LVIS_FOCUSED);
+    UpdateListView();
+}
+
 int GetSelectedBookId() {
     int sel = ListView_GetNextItem(g_hListView, -1, LVNI_SELECTED);
-    if (sel >= 0 && sel < static_cast<int>(g_currentBooks.size())) {
-        return g_currentBooks[sel].id;
-    }
-    return -1;
+    return sel >= 0 ? g_bookList.idAt(sel) : -1;
 }
 
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
@@ -303,7 +476,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             g_dialogBook = Book();
             if (DialogBoxW(g_hInst, MAKEINTRESOURCEW(IDD_BOOKDIALOG), hWnd, BookDlgProc) == IDOK) {
                 if (g_db.addBook(g_dialogBook)) {
-                    RefreshBookList();
+                    ApplyBookChanges();
                 } else {
                     MessageBoxW(hWnd, L"Failed to add book!", L"Error", MB_ICONERROR);
                 }
@@ -318,7 +491,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                 g_dialogBook = g_db.getBook(id);
                 if (DialogBoxW(g_hInst, MAKEINTRESOURCEW(IDD_BOOKDIALOG), hWnd, BookDlgProc) == IDOK) {
                     if (g_db.updateBook(g_dialogBook)) {
-                        RefreshBookList();
+                        ApplyBookChanges();
                     } else {
                         MessageBoxW(hWnd, L"Failed to update book!", L"Error", MB_ICONERROR);
                     }
@@ -336,7 +509,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                 if (MessageBoxW(hWnd, L"Are you sure you want to delete this book?", 
                     L"Confirm Delete", MB_YESNO | MB_ICONQUESTION) == IDYES) {
                     if (g_db.deleteBook(id)) {
-                        RefreshBookList();
+                        ApplyBookChanges();
                     } else {
                         MessageBoxW(hWnd, L"Failed to delete book!", L"Error", MB_ICONERROR);
                     }
@@ -357,6 +530,22 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             RefreshBookList();
             break;
             
+        case ID_FILE_IMPORT:
+            ImportCatalogue(hWnd);
+            break;
+            
+        case ID_FILE_EXPORT:
+            ExportCatalogue(hWnd);
+            break;
+            
+        case ID_FILE_BACKUP:
+            BackupDatabase(hWnd);
+            break;
+            
+        case ID_FILE_COMPACT:
+            CompactDatabase(hWnd);
+            break;
+            
         case ID_FILE_EXIT:
             DestroyWindow(hWnd);
             break;
@@ -369,13 +558,62 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         
     case WM_NOTIFY: {
         LPNMHDR pnmh = (LPNMHDR)lParam;
-        if (pnmh->idFrom == IDC_LISTVIEW && pnmh->code == NM_DBLCLK) {
+        if (pnmh->idFrom != IDC_LISTVIEW) break;
+        
+        if (pnmh->code == NM_DBLCLK) {
             SendMessage(hWnd, WM_COMMAND, IDC_BTN_EDIT, 0);
+        } else if (pnmh->code == LVN_GETDISPINFOW) {
+            NMLVDISPINFOW* info = (NMLVDISPINFOW*)lParam;
+            if ((info->item.mask & LVIF_TEXT) && info->item.cchTextMax > 0) {
+                const std::wstring& text = g_bookList.text(info->item.iItem, info->item.iSubItem);
+                lstrcpynW(info->item.pszText, text.c_str(), info->item.cchTextMax);
+            }
+        } else if (pnmh->code == LVN_ODCACHEHINT) {
+            NMLVCACHEHINT* hint = (NMLVCACHEHINT*)lParam;
+            g_bookList.prefetch(hint->iFrom, hint->iTo);
+        } else if (pnmh->code == LVN_COLUMNCLICK) {
+            // Clicking the sorted column again reverses the order
+            NMLISTVIEW* click = (NMLISTVIEW*)lParam;
+            bool descending = click->iSubItem == g_bookList.sortColumn() && !g_bookList.sortDescending();
+            int selectedId = GetSelectedBookId();
+            g_bookList.sortBy(click->iSubItem, descending);
+            
+            ListView_SetItemState(g_hListView, -1, 0, LVIS_SELECTED | LVIS_FOCUSED);
+            int row = selectedId > 0 ? g_bookList.rowOf(selectedId) : -1;
+            if (row >= 0) {
+                ListView_SetItemState(g_hListView, row, LVIS_SELECTED | LVIS_FOCUSED, LVIS_SELECTED | LVIS_FOCUSED);
+                ListView_EnsureVisible(g_hListView, row, FALSE);
+            }
+            InvalidateRect(g_hListView, nullptr, FALSE);
         }
         break;
     }
     
+    case WM_APP_RECONCILE:
+        StartReconcile(hWnd);
+        break;
+        
+    case WM_APP_RECONCILED:
+        FinishReconcile();
+        break;
+        
+    case WM_TIMER:
+        if (wParam == IDT_MAINTENANCE) {
+            LASTINPUTINFO input = {sizeof(LASTINPUTINFO)};
+            if (GetLastInputInfo(&input) && GetTickCount() - input.dwTime >= MAINTENANCE_IDLE) {
+                g_maintenance.runIdleSlice();
+            }
+        }
+        break;
+        
+    case WM_COMPACTING:
+        // Windows is short of memory; caches are rebuilt on demand
+        g_db.shedMemory();
+        break;
+        
     case WM_DESTROY:
+        KillTimer(hWnd, IDT_MAINTENANCE);
+        if (g_reconcileThread.joinable()) g_reconcileThread.join();
         PostQuitMessage(0);
         break;
         
@@ -481,23 +719,21 @@ INT_PTR CALLBACK SearchDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lP
         switch (LOWORD(wParam)) {
         case IDOK: {
             wchar_t buffer[512];
-            std::string author, title, publisher;
-            int yearFrom = 0, yearTo = 0;
+            BookFilter filter;
             
             GetDlgItemTextW(hDlg, IDC_EDIT_AUTHOR, buffer, 512);
-            author = WStringToString(buffer);
+            filter.author = WStringToString(buffer);
             
             GetDlgItemTextW(hDlg, IDC_EDIT_TITLE, buffer, 512);
-            title = WStringToString(buffer);
+            filter.title = WStringToString(buffer);
             
             GetDlgItemTextW(hDlg, IDC_EDIT_PUBLISHER, buffer, 512);
-            publisher = WStringToString(buffer);
+            filter.publisher = WStringToString(buffer);
             
-            yearFrom = GetDlgItemInt(hDlg, IDC_EDIT_YEAR_FROM, nullptr, FALSE);
-            yearTo = GetDlgItemInt(hDlg, IDC_EDIT_YEAR_TO, nullptr, FALSE);
+            filter.yearFrom = GetDlgItemInt(hDlg, IDC_EDIT_YEAR_FROM, nullptr, FALSE);
+            filter.yearTo = GetDlgItemInt(hDlg, IDC_EDIT_YEAR_TO, nullptr, FALSE);
             
-            std::vector<Book> results = g_db.searchAdvanced(author, title, yearFrom, yearTo, publisher);
-            DisplaySearchResults(results);
+            DisplaySearchResults(filter);
             
             EndDialog(hDlg, IDOK);
             break;
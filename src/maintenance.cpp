@@ -0,0 +1,101 @@
+#include "maintenance.h"
+#include <algorithm>
+
+namespace {
+
+const int kMinSlicePages = 16;
+const int kMaxSlicePages = 16384;
+const int kMinBackfillBatch = 16;
+const int kMaxBackfillBatch = 200000;
+const int kMinFuzzyBatch = 1000;
+const int kMaxFuzzyBatch = 1000000;
+
+// Halves a batch that ran long, doubles one that finished well inside the target
+int adaptBatch(int batch, double elapsedMs, double targetMs, int minBatch, int maxBatch) {
+    if (elapsedMs > targetMs) return std::max(minBatch, batch / 2);
+    if (elapsedMs < targetMs / 4) return std::min(maxBatch, batch * 2);
+    return batch;
+}
+
+} // namespace
+
+MaintenanceScheduler::MaintenanceScheduler(Database& db, double targetSliceMs)
+    : db(db), targetMs(targetSliceMs) {
+    current.slicePages = 256;
+    current.backfillBatch = 5000;
+    current.fuzzyBatch = 20000;
+    // open() has just run PRAGMA optimize, so the first periodic pass waits a full interval
+    lastOptimize = std::chrono::steady_clock::now();
+}
+
+bool MaintenanceScheduler::runIdleSlice() {
+    if (!db.isOpen()) return false;
+    if (backfillsPending && backfillSlice()) return true;
+    if (fuzzySlice()) return true;
+    if (!db.getFreeSpaceStats(current.freeSpace)) return false;
+    const FreeSpaceStats& space = current.freeSpace;
+    if (space.autoVacuum == FreeSpaceStats::Incremental && space.freePages >= minFreePages) return vacuumSlice();
+    return optimizeSlice();
+}
+
+bool MaintenanceScheduler::backfillSlice() {
+    auto start = std::chrono::steady_clock::now();
+    int books = 0;
+    bool done = false;
+    bool success = db.runMigrationBatch(current.backfillBatch, books, done);
+    current.lastSliceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    backfillsPending = success && !done;
+    if (!success || books == 0) return false;
+
+    current.slices++;
+    current.backfillBooks += books;
+    current.backfillBatch = adaptBatch(current.backfillBatch, current.lastSliceMs, targetMs,
+                                       kMinBackfillBatch, kMaxBackfillBatch);
+    return true;
+}
+
+// Cheap to call once both indexes are complete: buildFuzzyIndexes() returns at once
+bool MaintenanceScheduler::fuzzySlice() {
+    auto start = std::chrono::steady_clock::now();
+    int keys = 0;
+    bool done = false;
+    bool success = db.buildFuzzyIndexes(current.fuzzyBatch, keys, done);
+    if (!success || keys == 0) return false;
+    current.lastSliceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    current.slices++;
+    current.fuzzyKeys += keys;
+    current.fuzzyBatch = adaptBatch(current.fuzzyBatch, current.lastSliceMs, targetMs, kMinFuzzyBatch, kMaxFuzzyBatch);
+    return true;
+}
+
+bool MaintenanceScheduler::vacuumSlice() {
+    auto start = std::chrono::steady_clock::now();
+    int freed = 0;
+    bool success = db.incrementalVacuum(current.slicePages, freed);
+    current.lastSliceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (!success) return false;
+
+    current.slices++;
+    current.pagesFreed += freed;
+    current.freeSpace.pageCount -= freed;
+    current.freeSpace.freePages -= freed;
+
+    current.slicePages = adaptBatch(current.slicePages, current.lastSliceMs, targetMs, kMinSlicePages, kMaxSlicePages);
+    return true;
+}
+
+bool MaintenanceScheduler::optimizeSlice() {
+    auto start = std::chrono::steady_clock::now();
+    if (start - lastOptimize < std::chrono::seconds(optimizeIntervalSec)) return false;
+    lastOptimize = start;
+
+    int pruned = 0;
+    if (db.pruneNames(pruned)) current.namesPruned += pruned;
+
+    // Bounded by analysis_limit, so this stays a short slice on large catalogues too
+    bool success = db.optimize();
+    current.lastOptimizeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (success) current.optimizeRuns++;
+    return success;
+}
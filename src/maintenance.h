@@ -0,0 +1,55 @@
+#ifndef MAINTENANCE_H
+#define MAINTENANCE_H
+
+#include <chrono>
+#include "database.h"
+
+struct MaintenanceStats {
+    long long slices = 0;
+    long long pagesFreed = 0;
+    double lastSliceMs = 0;
+    int slicePages = 0;         // Current vacuum slice size
+    long long backfillBooks = 0;
+    int backfillBatch = 0;      // Current migration backfill batch size
+    long long fuzzyKeys = 0;
+    int fuzzyBatch = 0;         // Current fuzzy index batch size
+    long long optimizeRuns = 0;
+    long long namesPruned = 0;  // Orphaned authors and publishers removed
+    double lastOptimizeMs = 0;
+    FreeSpaceStats freeSpace;   // As of the last runIdleSlice()
+};
+
+// Housekeeping run in small pieces while the user is idle. Each runIdleSlice()
+// does at most one bounded unit of work; the vacuum slice size adapts so a slice
+// stays near the target duration whatever the disk speed. Pending migration
+// backfills come first, batched the same way, then the fuzzy search indexes are
+// loaded; once the freelist is drained too, orphaned names are pruned and planner
+// statistics refreshed with Database::optimize() at most once per optimize interval.
+class MaintenanceScheduler {
+public:
+    explicit MaintenanceScheduler(Database& db, double targetSliceMs = 50);
+
+    // Returns true if work was done, false if there was nothing to do (or it failed)
+    bool runIdleSlice();
+
+    // Freelist pages below this are left alone; they are reused by later inserts anyway
+    void setMinFreePages(long long pages) { minFreePages = pages; }
+    void setOptimizeInterval(int seconds) { optimizeIntervalSec = seconds; }
+    const MaintenanceStats& stats() const { return current; }
+
+private:
+    Database& db;
+    double targetMs;
+    long long minFreePages = 256;
+    int optimizeIntervalSec = 3600;
+    std::chrono::steady_clock::time_point lastOptimize;
+    MaintenanceStats current;
+    bool backfillsPending = true;
+
+    bool backfillSlice();
+    bool fuzzySlice();
+    bool vacuumSlice();
+    bool optimizeSlice();
+};
+
+#endif // MAINTENANCE_H
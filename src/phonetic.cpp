@@ -0,0 +1,138 @@
+#include "phonetic.h"
+#include "textfold.h"
+#include <cstring>
+
+namespace {
+
+struct Rule {
+    const char* pattern;
+    const char* atStart;
+    const char* beforeVowel;
+    const char* otherwise;
+};
+
+// Rules grouped by first letter, longest patterns first within each letter.
+const Rule kRules[] = {
+    {"ai", "0", "1", ""}, {"aj", "0", "1", ""}, {"ay", "0", "1", ""}, {"au", "0", "7", ""},
+    {"a", "0", "", ""},
+    {"b", "7", "7", "7"},
+    {"chs", "5", "54", "54"}, {"csz", "4", "4", "4"}, {"czs", "4", "4", "4"},
+    {"ch", "5", "5", "5"}, {"ck", "5", "5", "5"}, {"cs", "4", "4", "4"}, {"cz", "4", "4", "4"},
+    {"c", "5", "5", "5"},
+    {"drz", "4", "4", "4"}, {"drs", "4", "4", "4"}, {"dsh", "4", "4", "4"}, {"dsz", "4", "4", "4"},
+    {"dzh", "4", "4", "4"}, {"dzs", "4", "4", "4"},
+    {"ds", "4", "4", "4"}, {"dz", "4", "4", "4"}, {"dt", "3", "3", "3"},
+    {"d", "3", "3", "3"},
+    {"ei", "0", "1", ""}, {"ej", "0", "1", ""}, {"ey", "0", "1", ""}, {"eu", "1", "1", ""},
+    {"e", "0", "", ""},
+    {"fb", "7", "7", "7"}, {"f", "7", "7", "7"},
+    {"g", "5", "5", "5"},
+    {"h", "5", "5", ""},
+    {"ia", "1", "", ""}, {"ie", "1", "", ""}, {"io", "1", "", ""}, {"iu", "1", "", ""},
+    {"i", "0", "", ""},
+    {"j", "1", "", ""},
+    {"kh", "5", "5", "5"}, {"ks", "5", "54", "54"}, {"k", "5", "5", "5"},
+    {"l", "8", "8", "8"},
+    {"mn", "66", "66", "66"}, {"m", "6", "6", "6"},
+    {"nm", "66", "66", "66"}, {"n", "6", "6", "6"},
+    {"oi", "0", "1", ""}, {"oj", "0", "1", ""}, {"oy", "0", "1", ""},
+    {"o", "0", "", ""},
+    {"pf", "7", "7", "7"}, {"ph", "7", "7", "7"}, {"p", "7", "7", "7"},
+    {"q", "5", "5", "5"},
+    {"rz", "94", "94", "94"}, {"rs", "94", "94", "94"}, {"r", "9", "9", "9"},
+    {"schtsch", "2", "4", "4"}, {"schtsh", "2", "4", "4"}, {"schtch", "2", "4", "4"},
+    {"stsch", "2", "4", "4"},
+    {"strz", "2", "4", "4"}, {"strs", "2", "4", "4"}, {"stsh", "2", "4", "4"}, {"stch", "2", "4", "4"},
+    {"szcz", "2", "4", "4"}, {"szcs", "2", "4", "4"}, {"shch", "2", "4", "4"},
+    {"scht", "2", "43", "43"}, {"schd", "2", "43", "43"},
+    {"sht", "2", "43", "43"}, {"szt", "2", "43", "43"}, {"shd", "2", "43", "43"},
+    {"szd", "2", "43", "43"}, {"sch", "4", "4", "4"},
+    {"sh", "4", "4", "4"}, {"sz", "4", "4", "4"}, {"st", "2", "43", "43"}, {"sc", "2", "4", "4"},
+    {"sd", "2", "43", "43"},
+    {"s", "4", "4", "4"},
+    {"ttsch", "4", "4", "4"},
+    {"tsch", "4", "4", "4"}, {"ttch", "4", "4", "4"}, {"ttsz", "4", "4", "4"},
+    {"tch", "4", "4", "4"}, {"trz", "4", "4", "4"}, {"trs", "4", "4", "4"}, {"tsh", "4", "4", "4"},
+    {"tsz", "4", "4", "4"}, {"tts", "4", "4", "4"}, {"ttz", "4", "4", "4"}, {"tzs", "4", "4", "4"},
+    {"th", "3", "3", "3"}, {"ts", "4", "4", "4"}, {"tc", "4", "4", "4"}, {"tz", "4", "4", "4"},
+    {"t", "3", "3", "3"},
+    {"ui", "0", "1", ""}, {"uj", "0", "1", ""}, {"uy", "0", "1", ""}, {"ue", "0", "", ""},
+    {"u", "0", "", ""},
+    {"v", "7", "7", "7"},
+    {"w", "7", "7", "7"},
+    {"x", "5", "54", "54"},
+    {"y", "1", "", ""},
+    {"zhdzh", "2", "4", "4"},
+    {"zdzh", "2", "4", "4"}, {"zsch", "4", "4", "4"},
+    {"zdz", "2", "4", "4"}, {"zhd", "2", "43", "43"}, {"zsh", "4", "4", "4"},
+    {"zd", "2", "43", "43"}, {"zh", "4", "4", "4"}, {"zs", "4", "4", "4"},
+    {"z", "4", "4", "4"},
+};
+
+const size_t kCodeLength = 6;
+
+bool isVowel(char c) {
+    return c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u';
+}
+
+const Rule* matchRule(const std::string& word, size_t pos) {
+    for (const Rule& rule : kRules) {
+        if (rule.pattern[0] != word[pos]) continue;
+        size_t len = std::strlen(rule.pattern);
+        if (word.compare(pos, len, rule.pattern) == 0) return &rule;
+    }
+    return nullptr;
+}
+
+// Encodes an already folded word made of the letters a-z.
+std::string encodeWord(const std::string& word) {
+    std::string code;
+    std::string last;
+    size_t pos = 0;
+
+    while (pos < word.size() && code.size() < kCodeLength) {
+        const Rule* rule = matchRule(word, pos);
+        if (!rule) {
+            last.clear();
+            pos++;
+            continue;
+        }
+
+        size_t next = pos + std::strlen(rule->pattern);
+        const char* digits = pos == 0 ? rule->atStart
+                           : (next < word.size() && isVowel(word[next])) ? rule->beforeVowel
+                           : rule->otherwise;
+
+        // Adjacent letters that sound the same are coded once
+        if (last != digits) code += digits;
+        last = digits;
+        pos = next;
+    }
+
+    code.resize(kCodeLength, '0');
+    return code;
+}
+
+} // namespace
+
+std::vector<std::string> phoneticCodes(const std::string& text) {
+    std::vector<std::string> codes;
+    std::string folded = foldText(text);
+    std::string word;
+
+    for (size_t i = 0; i <= folded.size(); i++) {
+        char c = i < folded.size() ? folded[i] : ' ';
+        if (c >= 'a' && c <= 'z') {
+            word += c;
+            continue;
+        }
+        if (word.empty()) continue;
+
+        std::string code = encodeWord(word);
+        bool seen = false;
+        for (const std::string& existing : codes) seen = seen || existing == code;
+        if (!seen) codes.push_back(code);
+        word.clear();
+    }
+    return codes;
+}
@@ -0,0 +1,14 @@
+#ifndef PHONETIC_H
+#define PHONETIC_H
+
+#include <string>
+#include <vector>
+
+// Daitch-Mokotoff style sound-alike codes for every word of a (possibly multi-word)
+// author string, without duplicates. Each code is six digits, built from multi-letter
+// rules that cover Polish (sz, cz, rz, szcz, dz) and German (sch, tsch, z, w)
+// spellings. Only the primary branch of ambiguous rules is used, so each word has
+// exactly one code ("Sienkiewicz", "Sienkewitz" -> "465740").
+std::vector<std::string> phoneticCodes(const std::string& text);
+
+#endif // PHONETIC_H
@@ -25,5 +25,9 @@
 #define ID_FILE_REFRESH     40005
 #define ID_FILE_EXIT        40006
 #define ID_HELP_ABOUT       40007
+#define ID_FILE_IMPORT      40008
+#define ID_FILE_EXPORT      40009
+#define ID_FILE_BACKUP      40010
+#define ID_FILE_COMPACT     40011
 
 #endif // RESOURCE_H
@@ -0,0 +1,293 @@
+#include "snapshot.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char kMagic[8] = {'L', 'M', 'S', 'N', 'A', 'P', '\r', '\n'};
+
+// Bumped whenever the layout below changes; older files are simply rebuilt
+const uint32_t kFormatVersion = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t headerSize;
+    int64_t changeVersion;
+    int32_t schemaVersion;
+    int32_t sortColumn;
+    uint32_t descending;
+    uint32_t rowCount;
+    uint32_t authorRankCount;
+    uint32_t publisherRankCount;
+    uint64_t titleBytes;
+    uint64_t payloadBytes;
+    uint64_t checksum;
+};
+static_assert(sizeof(SnapshotHeader) == 72, "snapshot header layout");
+
+size_t padded(size_t bytes) {
+    return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+// FNV-1a over 64-bit words; sections are zero-padded to whole words
+class Checksum {
+public:
+    void add(const void* data, size_t bytes) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        size_t whole = bytes & ~static_cast<size_t>(7);
+        for (size_t i = 0; i < whole; i += 8) {
+            uint64_t word;
+            memcpy(&word, p + i, 8);
+            mix(word);
+        }
+        if (whole < bytes) {
+            uint64_t word = 0;
+            memcpy(&word, p + whole, bytes - whole);
+            mix(word);
+        }
+    }
+
+    uint64_t value() const { return hash; }
+
+private:
+    uint64_t hash = 14695981039346656037ULL;
+
+    void mix(uint64_t word) {
+        hash ^= word;
+        hash *= 1099511628211ULL;
+    }
+};
+
+// Read-only mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+#ifdef _WIN32
+        std::wstring widePath = fs::u8path(path).wstring();
+        file = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return false;
+        size = static_cast<size_t>(fileSize.QuadPart);
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return false;
+        data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) return false;
+        size = static_cast<size_t>(info.st_size);
+        void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        data = view == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(view);
+#endif
+        return data != nullptr;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap(const_cast<unsigned char*>(data), size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+void writeSection(std::ofstream& out, Checksum& checksum, const void* data, size_t bytes) {
+    static const char zeros[8] = {};
+    out.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    out.write(zeros, static_cast<std::streamsize>(padded(bytes) - bytes));
+    checksum.add(data, bytes);
+}
+
+template <typename T>
+void writeColumn(std::ofstream& out, Checksum& checksum, const std::vector<BookSortKey>& keys, T BookSortKey::*field) {
+    std::vector<int32_t> column(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) column[i] = keys[i].*field;
+    writeSection(out, checksum, column.data(), column.size() * sizeof(int32_t));
+}
+
+bool fail(std::string& error, const std::string& message) {
+    error = message;
+    return false;
+}
+
+} // namespace
+
+bool writeListSnapshot(const std::string& path, const ListSnapshot& snapshot, std::string& error) {
+    const std::vector<BookSortKey>& keys = snapshot.keys;
+    if (keys.size() > UINT32_MAX) return fail(error, "Too many rows for a snapshot");
+
+    std::vector<uint32_t> titleEnds(keys.size());
+    uint64_t titleBytes = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        titleBytes += keys[i].title.size();
+        if (titleBytes > UINT32_MAX) return fail(error, "Titles too large for a snapshot");
+        titleEnds[i] = static_cast<uint32_t>(titleBytes);
+    }
+
+    SnapshotHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.formatVersion = kFormatVersion;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.changeVersion = snapshot.changeVersion;
+    header.schemaVersion = snapshot.schemaVersion;
+    header.sortColumn = snapshot.sortColumn;
+    header.descending = snapshot.descending ? 1 : 0;
+    header.rowCount = static_cast<uint32_t>(keys.size());
+    header.authorRankCount = static_cast<uint32_t>(snapshot.authorRanks.size());
+    header.publisherRankCount = static_cast<uint32_t>(snapshot.publisherRanks.size());
+    header.titleBytes = titleBytes;
+
+    fs::path target = fs::u8path(path);
+    fs::path temp = target;
+    temp += ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return fail(error, "Cannot create " + temp.u8string());
+
+    // The header is rewritten with sizes and checksum once the payload is out
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    Checksum checksum;
+    writeColumn(out, checksum, keys, &BookSortKey::id);
+    writeColumn(out, checksum, keys, &BookSortKey::authorId);
+    writeColumn(out, checksum, keys, &BookSortKey::publisherId);
+    writeColumn(out, checksum, keys, &BookSortKey::year);
+    writeColumn(out, checksum, keys, &BookSortKey::pages);
+    writeSection(out, checksum, titleEnds.data(), titleEnds.size() * sizeof(uint32_t));
+    writeSection(out, checksum, snapshot.authorRanks.data(), snapshot.authorRanks.size() * sizeof(uint32_t));
+    writeSection(out, checksum, snapshot.publisherRanks.data(), snapshot.publisherRanks.size() * sizeof(uint32_t));
+
+    std::string pool;
+    pool.reserve(static_cast<size_t>(titleBytes));
+    for (const BookSortKey& key : keys) pool += key.title;
+    writeSection(out, checksum, pool.data(), pool.size());
+
+    header.payloadBytes = static_cast<uint64_t>(out.tellp()) - sizeof(header);
+    header.checksum = checksum.value();
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+    if (!out) {
+        std::error_code ec;
+        fs::remove(temp, ec);
+        return fail(error, "Write to " + temp.u8string() + " failed");
+    }
+
+    std::error_code ec;
+    fs::rename(temp, target, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return fail(error, "Cannot replace " + path + ": " + ec.message());
+    }
+    return true;
+}
+
+bool readListSnapshot(const std::string& path, ListSnapshot& snapshot, std::string& error) {
+    MappedFile file;
+    if (!file.open(path)) return fail(error, "Cannot map " + path);
+
+    SnapshotHeader header;
+    if (file.size < sizeof(header)) return fail(error, "Snapshot truncated");
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) return fail(error, "Not a snapshot file");
+    if (header.formatVersion != kFormatVersion || header.headerSize != sizeof(header)) {
+        return fail(error, "Unsupported snapshot version");
+    }
+
+    // Every section size follows from the counts; together they must fill the file
+    const uint64_t rows = header.rowCount;
+    const uint64_t expected = 6 * padded(rows * 4) + padded(header.authorRankCount * 4ULL) +
+                              padded(header.publisherRankCount * 4ULL) + padded(header.titleBytes);
+    if (header.payloadBytes != expected || file.size - sizeof(header) != expected) {
+        return fail(error, "Snapshot size mismatch");
+    }
+
+    const unsigned char* payload = file.data + sizeof(header);
+    Checksum checksum;
+    const unsigned char* section = payload;
+    auto next = [&](size_t bytes) {
+        const unsigned char* start = section;
+        checksum.add(start, bytes);
+        section += padded(bytes);
+        return start;
+    };
+
+    // The mapping is page aligned and sections are padded to 8 bytes
+    const int32_t* ids = reinterpret_cast<const int32_t*>(next(rows * 4));
+    const int32_t* authorIds = reinterpret_cast<const int32_t*>(next(rows * 4));
+    const int32_t* publisherIds = reinterpret_cast<const int32_t*>(next(rows * 4));
+    const int32_t* years = reinterpret_cast<const int32_t*>(next(rows * 4));
+    const int32_t* pages = reinterpret_cast<const int32_t*>(next(rows * 4));
+    const uint32_t* titleEnds = reinterpret_cast<const uint32_t*>(next(rows * 4));
+    const uint32_t* authorRanks = reinterpret_cast<const uint32_t*>(next(header.authorRankCount * 4ULL));
+    const uint32_t* publisherRanks = reinterpret_cast<const uint32_t*>(next(header.publisherRankCount * 4ULL));
+    const char* titles = reinterpret_cast<const char*>(next(header.titleBytes));
+    if (checksum.value() != header.checksum) return fail(error, "Snapshot checksum mismatch");
+
+    snapshot.changeVersion = header.changeVersion;
+    snapshot.schemaVersion = header.schemaVersion;
+    snapshot.sortColumn = header.sortColumn;
+    snapshot.descending = header.descending != 0;
+    snapshot.authorRanks.assign(authorRanks, authorRanks + header.authorRankCount);
+    snapshot.publisherRanks.assign(publisherRanks, publisherRanks + header.publisherRankCount);
+
+    snapshot.keys.clear();
+    snapshot.keys.resize(rows);
+    uint32_t start = 0;
+    for (size_t i = 0; i < rows; i++) {
+        if (titleEnds[i] < start || titleEnds[i] > header.titleBytes) {
+            snapshot.keys.clear();
+            return fail(error, "Snapshot title offsets corrupt");
+        }
+        BookSortKey& key = snapshot.keys[i];
+        key.id = ids[i];
+        key.authorId = authorIds[i];
+        key.publisherId = publisherIds[i];
+        key.year = years[i];
+        key.pages = pages[i];
+        key.title.assign(titles + start, titleEnds[i] - start);
+        start = titleEnds[i];
+    }
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "database.h"
+
+// Contents of a list snapshot: the unfiltered list model as of one change-journal
+// version, so startup can show the list without querying every book.
+struct ListSnapshot {
+    long long changeVersion = 0;    // Database::getChangeVersion() when written
+    int schemaVersion = 0;          // Database::getSchemaVersion() when written
+    int sortColumn = 0;
+    bool descending = false;
+    std::vector<BookSortKey> keys;  // In title order
+    std::vector<uint32_t> authorRanks;
+    std::vector<uint32_t> publisherRanks;
+};
+
+// Binary file: a fixed header followed by one little-endian array per column and
+// a pool of title bytes, each section padded to 8 bytes and covered by a checksum.
+// The file is written to a temporary name and renamed into place.
+bool writeListSnapshot(const std::string& path, const ListSnapshot& snapshot, std::string& error);
+
+// Memory-maps the file and validates header, sizes and checksum before copying
+// the columns out; a truncated or foreign file is rejected, never half-loaded.
+bool readListSnapshot(const std::string& path, ListSnapshot& snapshot, std::string& error);
+
+#endif // SNAPSHOT_H
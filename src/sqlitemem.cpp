@@ -0,0 +1,252 @@
+#include "sqlitemem.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include "sqlite3.h"
+
+namespace {
+
+// Every block starts with its usable size; 8 bytes keeps the payload aligned as SQLite requires
+const size_t kHeaderBytes = 8;
+const size_t kChunkBytes = 256 * 1024;
+const size_t kMaxClassBytes = 32 * 1024;
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct Pool {
+    std::mutex mutex;
+    std::vector<size_t> classSizes;     // Usable bytes, ascending
+    std::vector<FreeBlock*> freeLists;  // One per class
+    std::vector<unsigned char*> chunks;
+    unsigned char* cursor = nullptr;
+    size_t remaining = 0;
+    SqliteMemoryStats stats;
+};
+
+Pool& pool() {
+    static Pool p;
+    return p;
+}
+
+// Page cache slots live for the rest of the process once SQLite has them
+unsigned char* g_pageCache = nullptr;
+bool g_pooled = false;
+
+size_t& blockSize(void* payload) {
+    return *reinterpret_cast<size_t*>(static_cast<unsigned char*>(payload) - kHeaderBytes);
+}
+
+// Two classes per power of two (16, 24, 32, 48, ...), so rounding wastes at most a third
+void buildClasses(Pool& p) {
+    for (size_t size = 16; size <= kMaxClassBytes; size *= 2) {
+        p.classSizes.push_back(size);
+        if (size + size / 2 <= kMaxClassBytes) p.classSizes.push_back(size + size / 2);
+    }
+    p.freeLists.assign(p.classSizes.size(), nullptr);
+}
+
+size_t classIndex(const Pool& p, size_t bytes) {
+    return std::lower_bound(p.classSizes.begin(), p.classSizes.end(), bytes) - p.classSizes.begin();
+}
+
+// Takes a block of the given class from the current chunk; the tail of a used-up
+// chunk is handed to the largest class it still fits
+unsigned char* carve(Pool& p, size_t usable) {
+    size_t needed = usable + kHeaderBytes;
+    if (p.remaining < needed) {
+        while (p.remaining >= p.classSizes[0] + kHeaderBytes) {
+            size_t index = classIndex(p, p.remaining - kHeaderBytes + 1) - 1;
+            size_t size = p.classSizes[index];
+            *reinterpret_cast<size_t*>(p.cursor) = size;
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(p.cursor + kHeaderBytes);
+            block->next = p.freeLists[index];
+            p.freeLists[index] = block;
+            p.cursor += size + kHeaderBytes;
+            p.remaining -= size + kHeaderBytes;
+        }
+        unsigned char* chunk = static_cast<unsigned char*>(malloc(kChunkBytes));
+        if (!chunk) return nullptr;
+        p.chunks.push_back(chunk);
+        p.stats.arenaBytes += kChunkBytes;
+        p.cursor = chunk;
+        p.remaining = kChunkBytes;
+    }
+    unsigned char* block = p.cursor;
+    p.cursor += needed;
+    p.remaining -= needed;
+    *reinterpret_cast<size_t*>(block) = usable;
+    return block + kHeaderBytes;
+}
+
+int poolRoundup(int bytes) {
+    size_t n = bytes > 0 ? static_cast<size_t>(bytes) : 1;
+    if (n > kMaxClassBytes) return static_cast<int>((n + 7) & ~static_cast<size_t>(7));
+    const Pool& p = pool();
+    return static_cast<int>(p.classSizes[classIndex(p, n)]);
+}
+
+void* poolMalloc(int bytes) {
+    size_t usable = static_cast<size_t>(poolRoundup(bytes));
+    Pool& p = pool();
+    void* payload = nullptr;
+
+    if (usable > kMaxClassBytes) {
+        unsigned char* block = static_cast<unsigned char*>(malloc(usable + kHeaderBytes));
+        if (!block) return nullptr;
+        *reinterpret_cast<size_t*>(block) = usable;
+        payload = block + kHeaderBytes;
+    }
+
+    std::lock_guard<std::mutex> lock(p.mutex);
+    if (!payload) {
+        size_t index = classIndex(p, usable);
+        if (FreeBlock* block = p.freeLists[index]) {
+            p.freeLists[index] = block->next;
+            payload = block;
+        } else {
+            payload = carve(p, usable);
+            if (!payload) return nullptr;
+        }
+    } else {
+        p.stats.largeBytes += static_cast<long long>(usable);
+    }
+    p.stats.mallocCalls++;
+    p.stats.bytesInUse += static_cast<long long>(usable);
+    p.stats.peakBytesInUse = std::max(p.stats.peakBytesInUse, p.stats.bytesInUse);
+    return payload;
+}
+
+void poolFree(void* payload) {
+    if (!payload) return;
+    size_t usable = blockSize(payload);
+    Pool& p = pool();
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        p.stats.freeCalls++;
+        p.stats.bytesInUse -= static_cast<long long>(usable);
+        if (usable <= kMaxClassBytes) {
+            size_t index = classIndex(p, usable);
+            FreeBlock* block = static_cast<FreeBlock*>(payload);
+            block->next = p.freeLists[index];
+            p.freeLists[index] = block;
+            return;
+        }
+        p.stats.largeBytes -= static_cast<long long>(usable);
+    }
+    free(static_cast<unsigned char*>(payload) - kHeaderBytes);
+}
+
+int poolSize(void* payload) {
+    return payload ? static_cast<int>(blockSize(payload)) : 0;
+}
+
+// SQLite passes sizes already rounded with poolRoundup(); a move is also counted
+// as one malloc and one free
+void* poolRealloc(void* payload, int bytes) {
+    size_t usable = blockSize(payload);
+    if (static_cast<size_t>(poolRoundup(bytes)) == usable) return payload;
+    void* resized = poolMalloc(bytes);
+    if (!resized) return nullptr;
+    memcpy(resized, payload, std::min(usable, static_cast<size_t>(bytes)));
+    poolFree(payload);
+
+    Pool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    p.stats.reallocCalls++;
+    return resized;
+}
+
+int poolInit(void*) {
+    Pool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    if (p.classSizes.empty()) buildClasses(p);
+    return SQLITE_OK;
+}
+
+void poolShutdown(void*) {
+    Pool& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    for (unsigned char* chunk : p.chunks) free(chunk);
+    p.chunks.clear();
+    std::fill(p.freeLists.begin(), p.freeLists.end(), nullptr);
+    p.cursor = nullptr;
+    p.remaining = 0;
+    p.stats.arenaBytes = 0;
+}
+
+bool check(int rc, const char* option, std::string& error) {
+    if (rc == SQLITE_OK) return true;
+    error = std::string("sqlite3_config(") + option + "): " + sqlite3_errstr(rc) +
+            (rc == SQLITE_MISUSE ? " (SQLite is already initialized)" : "");
+    return false;
+}
+
+} // namespace
+
+bool configureSqliteMemory(const SqliteMemoryConfig& config, std::string& error) {
+    if (!check(sqlite3_config(SQLITE_CONFIG_MEMSTATUS, config.memStatus ? 1 : 0), "MEMSTATUS", error)) return false;
+
+    if (config.pooledAllocator) {
+        // Classes are needed by xRoundup before SQLite calls xInit
+        poolInit(nullptr);
+        static const sqlite3_mem_methods methods = {
+            poolMalloc, poolFree, poolRealloc, poolSize, poolRoundup, poolInit, poolShutdown, nullptr
+        };
+        if (!check(sqlite3_config(SQLITE_CONFIG_MALLOC, &methods), "MALLOC", error)) return false;
+        g_pooled = true;
+    }
+
+    if (config.pageCacheSlots > 0 && !g_pageCache) {
+        // Each slot holds a page plus the page cache's per-page header
+        int headerBytes = 0;
+        if (!check(sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &headerBytes), "PCACHE_HDRSZ", error)) return false;
+        int slotBytes = (config.pageSize + headerBytes + 7) & ~7;
+        g_pageCache = static_cast<unsigned char*>(malloc(static_cast<size_t>(slotBytes) * config.pageCacheSlots));
+        if (!g_pageCache) {
+            error = "Cannot allocate the page cache";
+            return false;
+        }
+        if (!check(sqlite3_config(SQLITE_CONFIG_PAGECACHE, g_pageCache, slotBytes, config.pageCacheSlots),
+                   "PAGECACHE", error)) {
+            return false;
+        }
+        pool().stats.pageCacheSlots = config.pageCacheSlots;
+        pool().stats.pageCacheSlotBytes = slotBytes;
+    }
+
+    if (!check(sqlite3_config(SQLITE_CONFIG_LOOKASIDE, config.lookasideSlotSize, config.lookasideSlots),
+               "LOOKASIDE", error)) {
+        return false;
+    }
+
+    int rc = sqlite3_initialize();
+    if (rc != SQLITE_OK) {
+        error = std::string("sqlite3_initialize: ") + sqlite3_errstr(rc);
+        return false;
+    }
+    return true;
+}
+
+SqliteMemoryStats getSqliteMemoryStats() {
+    Pool& p = pool();
+    SqliteMemoryStats stats;
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        stats = p.stats;
+    }
+    stats.pooled = g_pooled;
+
+    sqlite3_int64 current = 0, peak = 0;
+    if (sqlite3_status64(SQLITE_STATUS_PAGECACHE_USED, &current, &peak, 0) == SQLITE_OK) {
+        stats.pageCacheSlotsUsed = current;
+        stats.pageCacheSlotsPeak = peak;
+    }
+    if (sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &current, &peak, 0) == SQLITE_OK) {
+        stats.pageCacheOverflowBytes = current;
+    }
+    return stats;
+}
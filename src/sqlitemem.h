@@ -0,0 +1,47 @@
+#ifndef SQLITEMEM_H
+#define SQLITEMEM_H
+
+#include <string>
+
+// Process-wide SQLite memory setup, applied by configureSqliteMemory() before the
+// first connection is opened
+struct SqliteMemoryConfig {
+    bool pooledAllocator = true;    // Size-class pool below instead of the system malloc
+    int pageCacheSlots = 2048;      // Preallocated page cache pages (0 = none); 8 MB at 4 KB pages
+    int pageSize = 4096;            // Largest page size the preallocated slots must hold
+    int lookasideSlotSize = 1200;   // Per-connection small-object buffer
+    int lookasideSlots = 128;
+    bool memStatus = false;         // SQLite's own usage counters; cost a global mutex per malloc
+};
+
+struct SqliteMemoryStats {
+    bool pooled = false;
+    long long mallocCalls = 0;
+    long long freeCalls = 0;
+    long long reallocCalls = 0;     // Moves only; resizes within the block are free
+    long long bytesInUse = 0;       // Usable bytes handed to SQLite and not yet freed
+    long long peakBytesInUse = 0;
+    long long arenaBytes = 0;       // Reserved in chunks for the size classes
+    long long largeBytes = 0;       // Live allocations too big for a class, from malloc
+    long long pageCacheSlotsUsed = 0;
+    long long pageCacheSlotsPeak = 0;
+    long long pageCacheOverflowBytes = 0;   // Pages that did not fit the preallocated slots
+    int pageCacheSlots = 0;
+    int pageCacheSlotBytes = 0;     // Page plus header, as handed to SQLITE_CONFIG_PAGECACHE
+};
+
+// Must run before any sqlite3_open()/sqlite3_initialize(); afterwards SQLite rejects
+// the configuration and false is returned with the reason in error.
+//
+// The pooled allocator serves requests up to 32 KB from size classes (two per
+// power of two) carved out of 256 KB chunks; freed blocks go back to their class's
+// free list, so a long session reuses the same memory instead of fragmenting the
+// process heap. Chunks are only released by sqlite3_shutdown(). Larger requests,
+// e.g. big BLOB rows, go straight to malloc.
+bool configureSqliteMemory(const SqliteMemoryConfig& config, std::string& error);
+
+// Allocator counters come from the pool itself, so they work with memStatus off;
+// the page cache figures come from sqlite3_status64().
+SqliteMemoryStats getSqliteMemoryStats();
+
+#endif // SQLITEMEM_H
@@ -0,0 +1,109 @@
+#include "textfold.h"
+
+namespace {
+
+// Base letter for U+00C0..U+00FF. '-' keeps the code point, '*' expands to two letters.
+const char kLatin1[] =
+    "aaaaaa*c" "eeeeiiii" "dnooooo-" "ouuuuy**"
+    "aaaaaa*c" "eeeeiiii" "dnooooo-" "ouuuuy*y";
+
+// Base letter for U+0100..U+017F (Latin Extended-A).
+const char kLatinExtA[] =
+    "aaaaaaccccccccdd" "ddeeeeeeeeeegggg" "gggghhhhiiiiiiii" "ii**jjkkklllllll"
+    "lllnnnnnnnnnoooo" "oo**rrrrrrssssss" "ssttttttuuuuuuuu" "uuuuwwyyyzzzzzzs";
+
+const char* expandLigature(unsigned int cp) {
+    switch (cp) {
+    case 0x00C6: case 0x00E6: return "ae";
+    case 0x00DE: case 0x00FE: return "th";
+    case 0x00DF: return "ss";
+    case 0x0132: case 0x0133: return "ij";
+    case 0x0152: case 0x0153: return "oe";
+    }
+    return nullptr;
+}
+
+void appendUtf8(std::string& out, unsigned int cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// Decodes one code point starting at text[i]; returns its byte length, or 0 if malformed.
+size_t decodeUtf8(const std::string& text, size_t i, unsigned int& cp) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    size_t len;
+    if (c < 0x80) { cp = c; return 1; }
+    else if ((c & 0xE0) == 0xC0) { cp = c & 0x1F; len = 2; }
+    else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; len = 3; }
+    else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; len = 4; }
+    else return 0;
+
+    if (i + len > text.size()) return 0;
+    for (size_t k = 1; k < len; k++) {
+        unsigned char cc = static_cast<unsigned char>(text[i + k]);
+        if ((cc & 0xC0) != 0x80) return 0;
+        cp = (cp << 6) | (cc & 0x3F);
+    }
+    return len;
+}
+
+} // namespace
+
+std::string foldText(const std::string& text) {
+    std::string out;
+    out.reserve(text.size());
+
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c < 0x80) {
+            out += (c >= 'A' && c <= 'Z') ? static_cast<char>(c + 32) : static_cast<char>(c);
+            i++;
+            continue;
+        }
+
+        unsigned int cp;
+        size_t len = decodeUtf8(text, i, cp);
+        if (len == 0) {
+            out += static_cast<char>(c);
+            i++;
+            continue;
+        }
+        i += len;
+
+        if (cp >= 0x00C0 && cp <= 0x017F) {
+            char base = cp < 0x0100 ? kLatin1[cp - 0x00C0] : kLatinExtA[cp - 0x0100];
+            if (base == '*') {
+                out += expandLigature(cp);
+                continue;
+            }
+            if (base != '-') {
+                out += base;
+                continue;
+            }
+        } else if (cp >= 0x0300 && cp <= 0x036F) {
+            continue;  // Combining diacritical marks (decomposed input)
+        } else if (cp >= 0x0391 && cp <= 0x03A9 && cp != 0x03A2) {
+            cp += 0x20;  // Greek capitals
+        } else if (cp >= 0x0410 && cp <= 0x042F) {
+            cp += 0x20;  // Cyrillic capitals
+        } else if (cp >= 0x0400 && cp <= 0x040F) {
+            cp += 0x50;  // Cyrillic capitals with diacritics
+        }
+        appendUtf8(out, cp);
+    }
+    return out;
+}
@@ -0,0 +1,12 @@
+#ifndef TEXTFOLD_H
+#define TEXTFOLD_H
+
+#include <string>
+
+// Folds UTF-8 text into a search key: lowercase, diacritics stripped and
+// ligatures expanded ("Łódź" -> "lodz", "Müller" -> "muller", "Straße" -> "strasse").
+// Covers ASCII, Latin-1, Latin Extended-A, combining marks and basic Greek/Cyrillic
+// case; everything else is copied through unchanged.
+std::string foldText(const std::string& text);
+
+#endif // TEXTFOLD_H
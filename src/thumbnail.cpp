@@ -0,0 +1,200 @@
+#include "thumbnail.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+// Larger images are rejected before any allocation; covers are far smaller
+const int kMaxImageSide = 16384;
+
+const unsigned char kBackground = 0xF0;
+
+std::vector<ImageDecoder>& decoders() {
+    static std::vector<ImageDecoder> list;
+    return list;
+}
+
+uint32_t readLe(const unsigned char* p, int bytes) {
+    uint32_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) value = (value << 8) | p[i];
+    return value;
+}
+
+bool validSize(long long width, long long height) {
+    return width > 0 && height > 0 && width <= kMaxImageSide && height <= kMaxImageSide;
+}
+
+// PNM header fields are whitespace-separated decimals with '#' comments between them
+bool readPnmNumber(const unsigned char* data, size_t size, size_t& pos, long long& value) {
+    while (pos < size) {
+        if (data[pos] == '#') {
+            while (pos < size && data[pos] != '\n') pos++;
+        } else if (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\r' || data[pos] == '\n') {
+            pos++;
+        } else {
+            break;
+        }
+    }
+    if (pos >= size || data[pos] < '0' || data[pos] > '9') return false;
+    value = 0;
+    while (pos < size && data[pos] >= '0' && data[pos] <= '9') {
+        value = value * 10 + (data[pos++] - '0');
+        if (value > 1000000) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool decodeBmp(const unsigned char* data, size_t size, Image& image) {
+    if (size < 54 || data[0] != 'B' || data[1] != 'M') return false;
+    uint32_t pixelOffset = readLe(data + 10, 4);
+    uint32_t headerSize = readLe(data + 14, 4);
+    if (headerSize < 40 || 14 + static_cast<size_t>(headerSize) > size) return false;
+
+    long long width = static_cast<int32_t>(readLe(data + 18, 4));
+    long long height = static_cast<int32_t>(readLe(data + 22, 4));
+    int bits = static_cast<int>(readLe(data + 28, 2));
+    uint32_t compression = readLe(data + 30, 4);
+    uint32_t colorsUsed = readLe(data + 46, 4);
+
+    // BI_BITFIELDS with the standard masks (what most tools write for 32 bpp) is laid
+    // out like BI_RGB. The masks follow a 40-byte header and sit in the same place
+    // inside the larger V4/V5 headers.
+    if (compression == 3) {
+        if (bits != 32 || size < 66) return false;
+        if (readLe(data + 54, 4) != 0x00FF0000 || readLe(data + 58, 4) != 0x0000FF00 ||
+            readLe(data + 62, 4) != 0x000000FF) {
+            return false;
+        }
+        compression = 0;
+    }
+
+    // Positive heights are stored bottom-up
+    bool bottomUp = height > 0;
+    if (height < 0) height = -height;
+    if (!validSize(width, height) || compression != 0) return false;
+    if (bits != 1 && bits != 4 && bits != 8 && bits != 24 && bits != 32) return false;
+
+    std::vector<unsigned char> palette;
+    if (bits <= 8) {
+        size_t entries = colorsUsed ? colorsUsed : (size_t(1) << bits);
+        size_t paletteStart = 14 + headerSize;
+        if (entries > 256 || paletteStart + entries * 4 > size) return false;
+        palette.assign(data + paletteStart, data + paletteStart + entries * 4);
+    }
+
+    size_t stride = ((static_cast<size_t>(width) * bits + 31) / 32) * 4;
+    if (pixelOffset > size || stride * height > size - pixelOffset) return false;
+
+    image.width = static_cast<int>(width);
+    image.height = static_cast<int>(height);
+    image.rgb.assign(static_cast<size_t>(width) * height * 3, 0);
+    for (long long y = 0; y < height; y++) {
+        const unsigned char* row = data + pixelOffset + stride * (bottomUp ? height - 1 - y : y);
+        unsigned char* out = &image.rgb[static_cast<size_t>(y) * width * 3];
+        for (long long x = 0; x < width; x++, out += 3) {
+            if (bits >= 24) {
+                const unsigned char* p = row + x * (bits / 8);
+                out[0] = p[2];
+                out[1] = p[1];
+                out[2] = p[0];
+                continue;
+            }
+            size_t bit = static_cast<size_t>(x) * bits;
+            unsigned index = (row[bit / 8] >> (8 - bits - bit % 8)) & ((1u << bits) - 1);
+            if (index * 4 + 3 >= palette.size()) return false;
+            out[0] = palette[index * 4 + 2];
+            out[1] = palette[index * 4 + 1];
+            out[2] = palette[index * 4];
+        }
+    }
+    return true;
+}
+
+bool decodePpm(const unsigned char* data, size_t size, Image& image) {
+    if (size < 3 || data[0] != 'P' || (data[1] != '6' && data[1] != '5')) return false;
+    bool gray = data[1] == '5';
+    size_t pos = 2;
+    long long width, height, maxValue;
+    if (!readPnmNumber(data, size, pos, width) || !readPnmNumber(data, size, pos, height) ||
+        !readPnmNumber(data, size, pos, maxValue)) {
+        return false;
+    }
+    // Exactly one whitespace byte separates the header from the samples
+    pos++;
+    if (!validSize(width, height) || maxValue < 1 || maxValue > 65535) return false;
+
+    int channels = gray ? 1 : 3;
+    int sampleBytes = maxValue > 255 ? 2 : 1;
+    size_t pixels = static_cast<size_t>(width) * height;
+    if (pos > size || pixels * channels * sampleBytes > size - pos) return false;
+
+    image.width = static_cast<int>(width);
+    image.height = static_cast<int>(height);
+    image.rgb.resize(pixels * 3);
+    const unsigned char* in = data + pos;
+    for (size_t i = 0; i < pixels; i++) {
+        for (int c = 0; c < 3; c++) {
+            const unsigned char* sample = in + (i * channels + (gray ? 0 : c)) * sampleBytes;
+            long long value = sampleBytes == 2 ? (sample[0] << 8 | sample[1]) : sample[0];
+            image.rgb[i * 3 + c] = static_cast<unsigned char>(value * 255 / maxValue);
+        }
+    }
+    return true;
+}
+
+void registerImageDecoder(const ImageDecoder& decoder) {
+    decoders().push_back(decoder);
+}
+
+bool decodeImage(const std::vector<unsigned char>& data, Image& image) {
+    if (data.empty()) return false;
+    if (decodeBmp(data.data(), data.size(), image) || decodePpm(data.data(), data.size(), image)) return true;
+    for (const ImageDecoder& decoder : decoders()) {
+        if (decoder(data.data(), data.size(), image)) return true;
+    }
+    return false;
+}
+
+void makeThumbnail(const Image& image, int width, int height, std::vector<unsigned char>& pixels) {
+    size_t stride = thumbnailStride(width);
+    pixels.assign(stride * height, kBackground);
+    if (image.width <= 0 || image.height <= 0) return;
+
+    // Fit inside width x height without distortion
+    int fitWidth = width;
+    int fitHeight = static_cast<int>(static_cast<long long>(image.height) * width / image.width);
+    if (fitHeight > height) {
+        fitHeight = height;
+        fitWidth = static_cast<int>(static_cast<long long>(image.width) * height / image.height);
+    }
+    fitWidth = std::max(fitWidth, 1);
+    fitHeight = std::max(fitHeight, 1);
+    int left = (width - fitWidth) / 2;
+    int top = (height - fitHeight) / 2;
+
+    // Each output pixel averages the source rectangle it covers (at least one pixel)
+    for (int y = 0; y < fitHeight; y++) {
+        int y0 = static_cast<int>(static_cast<long long>(y) * image.height / fitHeight);
+        int y1 = std::max(y0 + 1, static_cast<int>(static_cast<long long>(y + 1) * image.height / fitHeight));
+        unsigned char* out = &pixels[stride * (top + y) + left * 3];
+        for (int x = 0; x < fitWidth; x++, out += 3) {
+            int x0 = static_cast<int>(static_cast<long long>(x) * image.width / fitWidth);
+            int x1 = std::max(x0 + 1, static_cast<int>(static_cast<long long>(x + 1) * image.width / fitWidth));
+            uint64_t sum[3] = {0, 0, 0};
+            for (int sy = y0; sy < y1; sy++) {
+                const unsigned char* in = &image.rgb[(static_cast<size_t>(sy) * image.width + x0) * 3];
+                for (int sx = x0; sx < x1; sx++, in += 3) {
+                    sum[0] += in[0];
+                    sum[1] += in[1];
+                    sum[2] += in[2];
+                }
+            }
+            uint64_t count = static_cast<uint64_t>(y1 - y0) * (x1 - x0);
+            out[0] = static_cast<unsigned char>(sum[2] / count);
+            out[1] = static_cast<unsigned char>(sum[1] / count);
+            out[2] = static_cast<unsigned char>(sum[0] / count);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Decoded image: 8-bit RGB triples, rows top to bottom without padding
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> rgb;
+};
+
+// Returns false when the data is not in the decoder's format or is damaged
+typedef std::function<bool(const unsigned char* data, size_t size, Image& image)> ImageDecoder;
+
+// Uncompressed BMP (1, 4, 8, 24 and 32 bits per pixel, 32 also as BI_BITFIELDS with
+// the standard masks) and binary PPM/PGM (P6/P5, 8 or 16 bits per sample) are built in
+bool decodeBmp(const unsigned char* data, size_t size, Image& image);
+bool decodePpm(const unsigned char* data, size_t size, Image& image);
+
+// Further formats (JPEG, PNG through a system codec) are added here; registered
+// decoders are tried after the built-in ones, in registration order
+void registerImageDecoder(const ImageDecoder& decoder);
+bool decodeImage(const std::vector<unsigned char>& data, Image& image);
+
+// Cover previews have one fixed size, so a grid row is a plain blit and 100 of them
+// come to about 1 MB. Pixels are BGR, top-down, each row padded to 4 bytes: what
+// StretchDIBits takes with a negative biHeight.
+const int kThumbnailWidth = 48;
+const int kThumbnailHeight = 72;
+
+struct Thumbnail {
+    int bookId = 0;
+    int width = 0;                      // 0 when the photo could not be decoded
+    int height = 0;
+    std::vector<unsigned char> pixels;
+};
+
+inline size_t thumbnailStride(int width) {
+    return (static_cast<size_t>(width) * 3 + 3) & ~static_cast<size_t>(3);
+}
+
+// Area-averaged downscale that keeps the aspect ratio, centred on a light background
+void makeThumbnail(const Image& image, int width, int height, std::vector<unsigned char>& pixels);
+
+#endif // THUMBNAIL_H
@@ -0,0 +1,118 @@
+// Checks every entry of the Latin-1 and Latin Extended-A folding tables
+#include "textfold.h"
+#include <cstdio>
+
+namespace {
+
+struct FoldRange {
+    unsigned int first;
+    unsigned int last;
+    const char* folded;     // nullptr: the code point is kept as it is
+};
+
+// Base letters per Unicode decomposition; strokes, ligatures and kra by hand
+const FoldRange kExpected[] = {
+    {0x00C0, 0x00C5, "a"},
+    {0x00C6, 0x00C6, "ae"},
+    {0x00C7, 0x00C7, "c"},
+    {0x00C8, 0x00CB, "e"},
+    {0x00CC, 0x00CF, "i"},
+    {0x00D0, 0x00D0, "d"},
+    {0x00D1, 0x00D1, "n"},
+    {0x00D2, 0x00D6, "o"},
+    {0x00D7, 0x00D7, nullptr},
+    {0x00D8, 0x00D8, "o"},
+    {0x00D9, 0x00DC, "u"},
+    {0x00DD, 0x00DD, "y"},
+    {0x00DE, 0x00DE, "th"},
+    {0x00DF, 0x00DF, "ss"},
+    {0x00E0, 0x00E5, "a"},
+    {0x00E6, 0x00E6, "ae"},
+    {0x00E7, 0x00E7, "c"},
+    {0x00E8, 0x00EB, "e"},
+    {0x00EC, 0x00EF, "i"},
+    {0x00F0, 0x00F0, "d"},
+    {0x00F1, 0x00F1, "n"},
+    {0x00F2, 0x00F6, "o"},
+    {0x00F7, 0x00F7, nullptr},
+    {0x00F8, 0x00F8, "o"},
+    {0x00F9, 0x00FC, "u"},
+    {0x00FD, 0x00FD, "y"},
+    {0x00FE, 0x00FE, "th"},
+    {0x00FF, 0x00FF, "y"},
+    {0x0100, 0x0105, "a"},
+    {0x0106, 0x010D, "c"},
+    {0x010E, 0x0111, "d"},
+    {0x0112, 0x011B, "e"},
+    {0x011C, 0x0123, "g"},
+    {0x0124, 0x0127, "h"},
+    {0x0128, 0x0131, "i"},
+    {0x0132, 0x0133, "ij"},
+    {0x0134, 0x0135, "j"},
+    {0x0136, 0x0138, "k"},
+    {0x0139, 0x0142, "l"},
+    {0x0143, 0x014B, "n"},
+    {0x014C, 0x0151, "o"},
+    {0x0152, 0x0153, "oe"},
+    {0x0154, 0x0159, "r"},
+    {0x015A, 0x0161, "s"},
+    {0x0162, 0x0167, "t"},
+    {0x0168, 0x0173, "u"},
+    {0x0174, 0x0175, "w"},
+    {0x0176, 0x0178, "y"},
+    {0x0179, 0x017E, "z"},
+    {0x017F, 0x017F, "s"},
+};
+
+// Code points in the tables are all two-byte sequences
+std::string utf8(unsigned int cp) {
+    std::string out;
+    out += static_cast<char>(0xC0 | (cp >> 6));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+    return out;
+}
+
+} // namespace
+
+int main() {
+    int failures = 0;
+    unsigned int next = 0x00C0;
+    for (const FoldRange& range : kExpected) {
+        if (range.first != next) {
+            std::printf("expectations skip U+%04X\n", next);
+            failures++;
+        }
+        for (unsigned int cp = range.first; cp <= range.last; cp++) {
+            std::string expected = range.folded ? range.folded : utf8(cp);
+            std::string folded = foldText(utf8(cp));
+            if (folded != expected) {
+                std::printf("U+%04X folds to \"%s\", expected \"%s\"\n", cp, folded.c_str(), expected.c_str());
+                failures++;
+            }
+        }
+        next = range.last + 1;
+    }
+    if (next != 0x0180) {
+        std::printf("expectations end at U+%04X\n", next);
+        failures++;
+    }
+
+    // Table lookups inside words, next to ASCII and multi-byte neighbours
+    struct { const char* text; const char* folded; } words[] = {
+        {"\xC5\x81\xC3\xB3" "d\xC5\xBA", "lodz"},
+        {"M\xC3\xBCller", "muller"},
+        {"Stra\xC3\x9F" "e", "strasse"},
+        {"\xC5\xA8" "ber", "uber"},
+        {"\xC5\xA0tefan \xC5\xA4" "ech", "stefan tech"},
+    };
+    for (const auto& word : words) {
+        std::string folded = foldText(word.text);
+        if (folded != word.folded) {
+            std::printf("\"%s\" folds to \"%s\", expected \"%s\"\n", word.text, folded.c_str(), word.folded);
+            failures++;
+        }
+    }
+
+    if (failures) std::printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}